@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "anim.h"
+#include "byte_order.h"
+
+// Unchanged cells between two changes are folded into one run when there
+// are at most this many: cheaper than the two header words of a new run.
+#define ANIM_RUN_GAP 2
+
+static bool writeWords( FILE * f, const uint32_t * words, size_t n ) {
+#ifdef BRD_HOST_IS_LE
+	return fwrite( words, 4, n, f ) == n;
+#else
+	size_t i;
+	unsigned char b[4];
+	for( i = 0; i < n; i++ ) {
+		putU32LE( b, words[i] );
+		if( fwrite( b, 1, 4, f ) != 4 ) {
+			return false;
+		}
+	}
+	return true;
+#endif
+}
+
+static void readWords( uint32_t * words, const unsigned char * in, size_t n ) {
+#ifdef BRD_HOST_IS_LE
+	memcpy( words, in, n * 4 );
+#else
+	size_t i;
+	for( i = 0; i < n; i++ ) {
+		words[i] = getU32LE( in + i*4 );
+	}
+#endif
+}
+
+// Row y of any layout into out[0..w), translated into another glyph table
+// when map is given.
+static void rowCells( Board * board, int y, Cell * out, GlyphMap * map ) {
+	int x, run;
+	for( x = 0; x < board->w; x += run ) {
+		const Cell * span = boardSpan( board, x, y, &run );
+		memcpy( out + x, span, run * sizeof(Cell) );
+	}
+	for( x = 0; map && x < board->w; x++ ) {
+		out[x] = cellSetPattern( out[x], glyphMapIndex( map, cellPattern( out[x] ) ) );
+	}
+}
+
+// Store len cells at x, y (all on row y) and mark just them dirty.
+static void writeRow( Board * board, int x, int y, const Cell * cells, int len ) {
+	int done, run;
+	for( done = 0; done < len; done += run ) {
+		Cell * dst = boardSpanWritable( board, x + done, y, &run );
+		if( !dst ) {
+			break;
+		}
+		if( run > len - done ) {
+			run = len - done;
+		}
+		memcpy( dst, cells + done, run * sizeof(Cell) );
+	}
+	boardMarkDirty( board, x, y, len, 1 );
+}
+
+static void writeKey( Board * board, const AnimClip * clip ) {
+	int y;
+	for( y = 0; y < clip->h; y++ ) {
+		writeRow( board, 0, y, clip->key + (size_t)y * clip->w, clip->w );
+	}
+}
+
+// Turn frame i into frame i+1 on board.
+static void applyDelta( Board * board, const AnimClip * clip, int i ) {
+	const uint32_t * d = clip->words + clip->delta_at[i];
+	uint32_t r, n_runs = *d++;
+	for( r = 0; r < n_runs; r++ ) {
+		uint32_t off = d[0], len = d[1];
+		writeRow( board, off % clip->w, off / clip->w, d + 2, len );
+		d += 2 + len;
+	}
+}
+
+// -- Editable animations
+
+// A one-frame animation. Takes ownership of first.
+Anim * animInit( Board * first ) {
+	Anim * anim = malloc( sizeof(Anim) );
+	if( !anim ) {
+		errLog( "animInit(): malloc() failed on anim" );
+		return NULL;
+	}
+	anim->cap = 8;
+	anim->n_frames = 0;
+	anim->frames = malloc( anim->cap * sizeof(Board *) );
+	anim->delays = malloc( anim->cap * sizeof(int) );
+	if( !anim->frames || !anim->delays ) {
+		errLog( "animInit(): malloc() failed on frame list" );
+		free( anim->frames );
+		free( anim->delays );
+		free( anim );
+		return NULL;
+	}
+	animInsertFrame( anim, 0, first, ANIM_DEFAULT_DELAY );
+	return anim;
+}
+
+void animFree( Anim * anim ) {
+	if( anim ) {
+		int i;
+		for( i = 0; i < anim->n_frames; i++ ) {
+			boardFree( anim->frames[i] );
+		}
+		free( anim->frames );
+		free( anim->delays );
+		free( anim );
+	}
+}
+
+// Insert frame before index at (n_frames appends). The animation takes
+// ownership of the frame, which must be the same size as the others.
+bool animInsertFrame( Anim * anim, int at, Board * frame, int delay_ms ) {
+	if( anim->n_frames > 0 && ( frame->w != anim->frames[0]->w || frame->h != anim->frames[0]->h ) ) {
+		errLog( "animInsertFrame(): frame is %dx%d, animation is %dx%d", frame->w, frame->h, anim->frames[0]->w, anim->frames[0]->h );
+		return false;
+	}
+	if( anim->n_frames == anim->cap ) {
+		int cap = anim->cap * 2;
+		Board ** frames = realloc( anim->frames, cap * sizeof(Board *) );
+		if( frames ) {
+			anim->frames = frames;
+		}
+		int * delays = realloc( anim->delays, cap * sizeof(int) );
+		if( delays ) {
+			anim->delays = delays;
+		}
+		if( !frames || !delays ) {
+			errLog( "animInsertFrame(): realloc() failed on %d frames", cap );
+			return false;
+		}
+		anim->cap = cap;
+	}
+	memmove( anim->frames + at + 1, anim->frames + at, ( anim->n_frames - at ) * sizeof(Board *) );
+	memmove( anim->delays + at + 1, anim->delays + at, ( anim->n_frames - at ) * sizeof(int) );
+	anim->frames[at] = frame;
+	anim->delays[at] = delay_ms;
+	anim->n_frames++;
+	return true;
+}
+
+// Take frame at out of the animation and return it; the caller frees it.
+// Removing the only frame leaves an empty animation, fit only for animFree().
+Board * animRemoveFrame( Anim * anim, int at ) {
+	Board * frame = anim->frames[at];
+	anim->n_frames--;
+	memmove( anim->frames + at, anim->frames + at + 1, ( anim->n_frames - at ) * sizeof(Board *) );
+	memmove( anim->delays + at, anim->delays + at + 1, ( anim->n_frames - at ) * sizeof(int) );
+	return frame;
+}
+
+bool animSave( Anim * anim, char * filename ) {
+	AnimClip * clip = animCompile( anim );
+	if( !clip ) {
+		return false;
+	}
+	bool ok = animClipSave( clip, filename );
+	animClipFree( clip );
+	return ok;
+}
+
+// Load a .bra animation, or any board file as a one-frame animation.
+Anim * animLoad( char * filename ) {
+	FileMap fm;
+	if( !fileMapOpen( &fm, filename ) ) {
+		errLog( "animLoad(): Could not load %s", filename );
+		return NULL;
+	}
+	Anim * anim = NULL;
+	if( fm.size >= ANIM_MAGIC_LEN && memcmp( fm.data, ANIM_MAGIC, ANIM_MAGIC_LEN ) == 0 ) {
+		AnimClip * clip = animClipFromMemory( fm.data, fm.size, filename );
+		if( clip ) {
+			anim = animFromClip( clip );
+			animClipFree( clip );
+		}
+	}
+	else {
+		Board * board = boardLoadFromMemory( fm.data, fm.size, filename );
+		if( board ) {
+			anim = animInit( board );
+			if( !anim ) {
+				boardFree( board );
+			}
+		}
+	}
+	fileMapClose( &fm );
+	return anim;
+}
+
+// -- Clips
+
+typedef struct WordBuf_t {
+	uint32_t * words;
+	size_t n;
+	size_t cap;
+	bool failed;
+} WordBuf;
+
+static uint32_t * wordsReserve( WordBuf * wb, size_t n ) {
+	if( wb->n + n > wb->cap ) {
+		size_t cap = wb->cap ? wb->cap * 2 : 1024;
+		while( cap < wb->n + n ) {
+			cap *= 2;
+		}
+		uint32_t * words = realloc( wb->words, cap * sizeof(uint32_t) );
+		if( !words ) {
+			errLog( "animCompile(): realloc() failed on %zu delta words", cap );
+			wb->failed = true;
+			return NULL;
+		}
+		wb->words = words;
+		wb->cap = cap;
+	}
+	uint32_t * out = wb->words + wb->n;
+	wb->n += n;
+	return out;
+}
+
+// Append the runs that turn prev into next. a and b are row scratch.
+static void encodeDelta( WordBuf * wb, Board * prev, Board * next, GlyphMap * prev_map, GlyphMap * next_map, Cell * a, Cell * b ) {
+	size_t count_at = wb->n;
+	uint32_t n_runs = 0;
+	int w = prev->w;
+	int x, y;
+	if( !wordsReserve( wb, 1 ) ) {
+		return;
+	}
+	for( y = 0; y < prev->h; y++ ) {
+		rowCells( prev, y, a, prev_map );
+		rowCells( next, y, b, next_map );
+		x = 0;
+		while( x < w ) {
+			if( a[x] == b[x] ) {
+				x++;
+				continue;
+			}
+			int start = x, end = x + 1;
+			for( x = end; x < w && x - end <= ANIM_RUN_GAP; x++ ) {
+				if( a[x] != b[x] ) {
+					end = x + 1;
+				}
+			}
+			uint32_t * run = wordsReserve( wb, 2 + end - start );
+			if( !run ) {
+				return;
+			}
+			run[0] = (uint32_t)y * w + start;
+			run[1] = end - start;
+			memcpy( run + 2, b + start, ( end - start ) * sizeof(Cell) );
+			n_runs++;
+			x = end;
+		}
+	}
+	wb->words[count_at] = n_runs;
+}
+
+static AnimClip * clipAlloc( int w, int h, bool color, int n_frames ) {
+	AnimClip * clip = calloc( 1, sizeof(AnimClip) );
+	if( !clip ) {
+		return NULL;
+	}
+	clip->w = w;
+	clip->h = h;
+	clip->color_enabled = color;
+	clip->n_frames = n_frames;
+	clip->delays = malloc( n_frames * sizeof(uint32_t) );
+	clip->key = malloc( (size_t)w * h * sizeof(Cell) );
+	clip->delta_at = malloc( n_frames * sizeof(size_t) );
+	if( !clip->delays || !clip->key || !clip->delta_at ) {
+		animClipFree( clip );
+		return NULL;
+	}
+	return clip;
+}
+
+// The clip's glyph table: a copy of frame 0's, so the keyframe needs no
+// translation, which other frames' glyphs are added to as they are met.
+// *glyphs is left NULL when no frame uses any.
+static bool clipGlyphs( Anim * anim, GlyphTable ** glyphs ) {
+	int i;
+	*glyphs = NULL;
+	for( i = 0; i < anim->n_frames && !( anim->frames[i]->glyphs && anim->frames[i]->glyphs->n ); i++ );
+	if( i == anim->n_frames ) {
+		return true;
+	}
+	*glyphs = glyphTableNew();
+	if( !*glyphs ) {
+		return false;
+	}
+	const GlyphTable * first = anim->frames[0]->glyphs;
+	for( i = 0; first && i < first->n; i++ ) {
+		glyphIntern( *glyphs, first->cp[i] );
+	}
+	return true;
+}
+
+// Map frame i's glyphs into the clip's table, or NULL if they already agree.
+static GlyphMap * frameMap( Anim * anim, AnimClip * clip, GlyphMap * maps, int i ) {
+	return glyphTablePrefixOf( anim->frames[i]->glyphs, clip->glyphs ) ? NULL : &maps[i];
+}
+
+// Encode the animation as a keyframe and deltas, for saving or playback.
+AnimClip * animCompile( Anim * anim ) {
+	Board * first = anim->frames[0];
+	int w = first->w, n = anim->n_frames;
+	AnimClip * clip = clipAlloc( w, first->h, first->color_enabled, n );
+	Cell * a = malloc( w * sizeof(Cell) );
+	Cell * b = malloc( w * sizeof(Cell) );
+	GlyphMap * maps = malloc( n * sizeof(GlyphMap) );
+	if( !clip || !a || !b || !maps || !clipGlyphs( anim, &clip->glyphs ) ) {
+		errLog( "animCompile(): malloc() failed on %dx%d, %d frames", w, first->h, n );
+		animClipFree( clip );
+		free( a );
+		free( b );
+		free( maps );
+		return NULL;
+	}
+	int i, y;
+	for( i = 0; i < n; i++ ) {
+		clip->delays[i] = anim->delays[i];
+		glyphMapInit( &maps[i], anim->frames[i]->glyphs, clip->glyphs );
+	}
+	for( y = 0; y < first->h; y++ ) {
+		rowCells( first, y, clip->key + (size_t)y * w, NULL );
+	}
+	WordBuf wb = { NULL, 0, 0, false };
+	for( i = 0; i < n && n > 1 && !wb.failed; i++ ) {
+		int next = ( i + 1 ) % n;
+		clip->delta_at[i] = wb.n;
+		encodeDelta( &wb, anim->frames[i], anim->frames[next], frameMap( anim, clip, maps, i ), frameMap( anim, clip, maps, next ), a, b );
+	}
+	free( a );
+	free( b );
+	free( maps );
+	clip->words = wb.words;
+	clip->n_words = wb.n;
+	if( wb.failed ) {
+		animClipFree( clip );
+		return NULL;
+	}
+	return clip;
+}
+
+// Decode every frame of a clip into an editable animation.
+Anim * animFromClip( const AnimClip * clip ) {
+	// writeKey() writes every cell.
+	Board * frame = boardAlloc( clip->w, clip->h, clip->color_enabled );
+	if( !frame ) {
+		return NULL;
+	}
+	// Later frames are copied from this one, so they all share the table.
+	frame->glyphs = glyphTableRetain( clip->glyphs );
+	writeKey( frame, clip );
+	boardClearDirty( frame );
+	Anim * anim = animInit( frame );
+	if( !anim ) {
+		boardFree( frame );
+		return NULL;
+	}
+	anim->delays[0] = clip->delays[0];
+	int i;
+	for( i = 1; i < clip->n_frames; i++ ) {
+		frame = boardMakeFromSelection( anim->frames[i - 1], 0, 0, clip->w, clip->h );
+		if( !frame ) {
+			animFree( anim );
+			return NULL;
+		}
+		applyDelta( frame, clip, i - 1 );
+		boardClearDirty( frame );
+		if( !animInsertFrame( anim, i, frame, clip->delays[i] ) ) {
+			boardFree( frame );
+			animFree( anim );
+			return NULL;
+		}
+	}
+	return anim;
+}
+
+void animClipFree( AnimClip * clip ) {
+	if( clip ) {
+		free( clip->delays );
+		free( clip->key );
+		free( clip->words );
+		free( clip->delta_at );
+		glyphTableRelease( clip->glyphs );
+		free( clip );
+	}
+}
+
+bool animClipSave( const AnimClip * clip, char * filename ) {
+	if( clip->n_words > UINT32_MAX ) {
+		errLog( "animClipSave(): %s: deltas too large for the format", filename );
+		return false;
+	}
+	unsigned char head[ANIM_HEADER_SIZE];
+	memcpy( head, ANIM_MAGIC, ANIM_MAGIC_LEN );
+	putU16LE( head + 4, ANIM_VERSION );
+	int n_glyphs = clip->glyphs ? clip->glyphs->n : 0;
+	putU16LE( head + 6, ( clip->color_enabled ? BRD_FLAG_COLOR : 0 ) | ( n_glyphs ? BRD_FLAG_GLYPHS : 0 ) );
+	putU32LE( head + 8, clip->w );
+	putU32LE( head + 12, clip->h );
+	putU32LE( head + 16, clip->n_frames );
+	putU32LE( head + 20, (uint32_t)clip->n_words );
+
+	char tmp_name[FILENAME_MAX];
+	FILE * f = saveOpen( filename, tmp_name, sizeof(tmp_name), "wb" );
+	if( !f ) {
+		return false;
+	}
+	bool ok = fwrite( head, 1, ANIM_HEADER_SIZE, f ) == ANIM_HEADER_SIZE
+		&& writeWords( f, clip->delays, clip->n_frames )
+		&& writeWords( f, clip->key, (size_t)clip->w * clip->h )
+		&& writeWords( f, clip->words, clip->n_words );
+	if( ok && n_glyphs ) {
+		uint32_t count = n_glyphs;
+		ok = writeWords( f, &count, 1 ) && writeWords( f, clip->glyphs->cp, n_glyphs );
+	}
+	return saveClose( f, tmp_name, filename, ok );
+}
+
+// Walk the deltas once, filling in delta_at and checking every run lies
+// inside one row, so playback can trust them.
+static bool checkDeltas( AnimClip * clip, char * filename ) {
+	size_t pos = 0;
+	int i;
+	for( i = 0; i < clip->n_frames && clip->n_frames > 1; i++ ) {
+		clip->delta_at[i] = pos;
+		if( pos >= clip->n_words ) {
+			errLog( "animClipLoad(): %s: delta %d is missing", filename, i );
+			return false;
+		}
+		uint32_t r, n_runs = clip->words[pos++];
+		for( r = 0; r < n_runs; r++ ) {
+			if( clip->n_words - pos < 2 ) {
+				errLog( "animClipLoad(): %s: delta %d is truncated", filename, i );
+				return false;
+			}
+			uint32_t off = clip->words[pos], len = clip->words[pos + 1];
+			pos += 2;
+			if( off >= (size_t)clip->w * clip->h || len < 1 || len > (uint32_t)( clip->w - off % clip->w ) || len > clip->n_words - pos ) {
+				errLog( "animClipLoad(): %s: delta %d has a bad run", filename, i );
+				return false;
+			}
+			pos += len;
+		}
+	}
+	if( pos != clip->n_words ) {
+		errLog( "animClipLoad(): %s: %zu stray delta words", filename, clip->n_words - pos );
+		return false;
+	}
+	return true;
+}
+
+// Read the glyph table trailer at in: u32 count, then the code points, as
+// in .brd files.
+static bool glyphsFromFile( AnimClip * clip, const unsigned char * in, const unsigned char * end, char * filename ) {
+	uint32_t i, n = end - in >= 4 ? getU32LE( in ) : 0;
+	if( n < 1 || n > GLYPH_TABLE_SIZE || (size_t)( end - in ) < 4 + n * 4 ) {
+		errLog( "animClipLoad(): %s has a truncated or oversized glyph table", filename );
+		return false;
+	}
+	clip->glyphs = glyphTableNew();
+	if( !clip->glyphs ) {
+		return false;
+	}
+	for( i = 0; i < n; i++ ) {
+		if( glyphIntern( clip->glyphs, getU32LE( in + 4 + i*4 ) ) != GLYPH_ASCII_END + (int)i ) {
+			errLog( "animClipLoad(): %s: glyph table entry %u is invalid", filename, i );
+			return false;
+		}
+	}
+	return true;
+}
+
+AnimClip * animClipFromMemory( const unsigned char * data, size_t size, char * filename ) {
+	if( size < ANIM_HEADER_SIZE || memcmp( data, ANIM_MAGIC, ANIM_MAGIC_LEN ) != 0 ) {
+		errLog( "animClipLoad(): %s is not an animation", filename );
+		return NULL;
+	}
+	unsigned int version = getU16LE( data + 4 );
+	unsigned int flags = getU16LE( data + 6 );
+	uint32_t w = getU32LE( data + 8 );
+	uint32_t h = getU32LE( data + 12 );
+	uint32_t n = getU32LE( data + 16 );
+	uint32_t n_words = getU32LE( data + 20 );
+	if( version != ANIM_VERSION ) {
+		errLog( "animClipLoad(): %s has unsupported version %u", filename, version );
+		return NULL;
+	}
+	if( w < 1 || h < 1 || w > INT_MAX || h > INT_MAX || n < 1 || n > INT_MAX ) {
+		errLog( "animClipLoad(): invalid dimensions (w%u h%u, %u frames) on %s", w, h, n, filename );
+		return NULL;
+	}
+	uint64_t need = ANIM_HEADER_SIZE + ( (uint64_t)n + (uint64_t)w * h + n_words ) * 4;
+	if( need > size ) {
+		errLog( "animClipLoad(): %s is truncated (%zu of %llu bytes)", filename, size, (unsigned long long)need );
+		return NULL;
+	}
+	AnimClip * clip = clipAlloc( w, h, ( flags & BRD_FLAG_COLOR ) != 0, n );
+	if( clip ) {
+		clip->words = malloc( ( n_words ? n_words : 1 ) * sizeof(uint32_t) );
+	}
+	if( !clip || !clip->words ) {
+		errLog( "animClipLoad(): malloc() failed on %s", filename );
+		animClipFree( clip );
+		return NULL;
+	}
+	clip->n_words = n_words;
+	const unsigned char * in = data + ANIM_HEADER_SIZE;
+	readWords( clip->delays, in, n );
+	in += (size_t)n * 4;
+	readWords( clip->key, in, (size_t)w * h );
+	in += (size_t)w * h * 4;
+	readWords( clip->words, in, n_words );
+	in += (size_t)n_words * 4;
+	if( !checkDeltas( clip, filename ) || ( ( flags & BRD_FLAG_GLYPHS ) && !glyphsFromFile( clip, in, data + size, filename ) ) ) {
+		animClipFree( clip );
+		return NULL;
+	}
+	return clip;
+}
+
+AnimClip * animClipLoad( char * filename ) {
+	FileMap fm;
+	if( !fileMapOpen( &fm, filename ) ) {
+		errLog( "animClipLoad(): Could not load %s", filename );
+		return NULL;
+	}
+	AnimClip * clip = animClipFromMemory( fm.data, fm.size, filename );
+	fileMapClose( &fm );
+	return clip;
+}
+
+// -- Playback
+
+/*  A player showing frame 0 of clip on its own board. fps > 0 plays at
+    that rate; 0 uses the delays stored with each frame. The clip must
+    outlive the player.                                                   */
+AnimPlayer * animPlayerInit( const AnimClip * clip, int fps ) {
+	AnimPlayer * p = malloc( sizeof(AnimPlayer) );
+	if( !p ) {
+		errLog( "animPlayerInit(): malloc() failed on player" );
+		return NULL;
+	}
+	// animPlayerSeek() writes every cell.
+	p->board = boardAlloc( clip->w, clip->h, clip->color_enabled );
+	if( !p->board ) {
+		free( p );
+		return NULL;
+	}
+	p->board->glyphs = glyphTableRetain( clip->glyphs );
+	p->clip = clip;
+	p->fps = fps;
+	animPlayerSeek( p, 0 );
+	return p;
+}
+
+void animPlayerFree( AnimPlayer * p ) {
+	if( p ) {
+		boardFree( p->board );
+		free( p );
+	}
+}
+
+// Jump to a frame: the keyframe plus the deltas up to it. The whole board
+// is marked dirty.
+void animPlayerSeek( AnimPlayer * p, int frame ) {
+	if( frame < 0 || frame >= p->clip->n_frames ) {
+		frame = 0;
+	}
+	writeKey( p->board, p->clip );
+	int i;
+	for( i = 0; i < frame; i++ ) {
+		applyDelta( p->board, p->clip, i );
+	}
+	p->frame = frame;
+	p->next_ms = -1;
+}
+
+static long frameDelay( const AnimPlayer * p, int frame ) {
+	long ms = p->fps > 0 ? 1000 / p->fps : (long)p->clip->delays[frame];
+	return ms > 0 ? ms : 1;
+}
+
+/*  Advance to the frame due at now_ms (any monotonic ms clock), applying a
+    delta per frame passed. Returns how many frames were advanced; when
+    non-zero, boardDrawDirty( p->board, ... ) repaints exactly the cells
+    that changed. The first call starts the clock. A player more than a
+    whole loop behind skips ahead rather than replaying the backlog.      */
+int animPlayerTick( AnimPlayer * p, long now_ms ) {
+	if( p->clip->n_frames < 2 ) {
+		return 0;
+	}
+	if( p->next_ms < 0 ) {
+		p->next_ms = now_ms + frameDelay( p, p->frame );
+		return 0;
+	}
+	int advanced = 0;
+	while( now_ms >= p->next_ms ) {
+		applyDelta( p->board, p->clip, p->frame );
+		p->frame = ( p->frame + 1 ) % p->clip->n_frames;
+		p->next_ms += frameDelay( p, p->frame );
+		if( ++advanced >= p->clip->n_frames ) {
+			p->next_ms = now_ms + frameDelay( p, p->frame );
+			break;
+		}
+	}
+	return advanced;
+}
+
+// Milliseconds until the next frame is due: 0 if it already is, -1 if the
+// clip has only one frame.
+long animPlayerWait( const AnimPlayer * p, long now_ms ) {
+	if( p->clip->n_frames < 2 ) {
+		return -1;
+	}
+	if( p->next_ms < 0 ) {
+		return 0;
+	}
+	return p->next_ms > now_ms ? p->next_ms - now_ms : 0;
+}
@@ -0,0 +1,91 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "board.h"
+
+/*  Multi-frame boards.
+
+    An Anim is the editable form: one full Board per frame, all the same
+    size, each with its own delay. An AnimClip is the stored and played
+    form: frame 0 as a keyframe, then one delta per frame holding only the
+    runs of cells that change. AnimPlayer plays a clip onto a single board,
+    writing only the changed cells and marking just those dirty, so
+    boardDrawDirty() repaints nothing else.
+
+    .bra file layout. All integers are little-endian.
+      0  char[4]     magic "BRDA"
+      4  u16         version (ANIM_VERSION)
+      6  u16         flags (BRD_FLAG_COLOR, BRD_FLAG_GLYPHS)
+      8  u32         width
+     12  u32         height
+     16  u32         frame count n
+     20  u32         total delta words
+     24  u32[n]      per-frame delay in ms
+     ..  u32[w*h]    frame 0, row-major Cell words
+     ..  deltas      when n > 1, n of them back to back; delta i turns frame
+                     i into frame i+1, and the last one turns frame n-1 back
+                     into frame 0 for looping. Each is u32 n_runs, then per
+                     run: u32 offset (y*w + x), u32 len, u32[len] new cells.
+                     A run never crosses a row.
+     ..  glyphs      when BRD_FLAG_GLYPHS is set: u32 count, then the code
+                     points of patterns 128.., as in .brd files.           */
+#define ANIM_MAGIC "BRDA"
+#define ANIM_MAGIC_LEN 4
+#define ANIM_VERSION 1
+#define ANIM_HEADER_SIZE 24
+
+#define ANIM_DEFAULT_DELAY 100      // ms, for new frames.
+#define ANIM_MAX_DELAY 60000
+
+typedef struct Anim_t {
+	Board ** frames;
+	int * delays;           // ms, per frame.
+	int n_frames;
+	int cap;
+} Anim;
+
+typedef struct AnimClip_t {
+	int w;
+	int h;
+	bool color_enabled;
+	int n_frames;
+	uint32_t * delays;
+	Cell * key;             // Frame 0, w*h cells row-major.
+	uint32_t * words;       // All deltas, back to back.
+	size_t n_words;
+	size_t * delta_at;      // Start of delta i in words (n_frames > 1 only).
+	GlyphTable * glyphs;    // Shared with boards made from the clip; may be NULL.
+} AnimClip;
+
+typedef struct AnimPlayer_t {
+	const AnimClip * clip;
+	Board * board;          // The current frame. Draw it with boardDrawDirty().
+	int frame;
+	int fps;                // 0: use each frame's own delay.
+	long next_ms;           // When the next frame is due; -1 until the first tick.
+} AnimPlayer;
+
+Anim * animInit( Board * first );
+void animFree( Anim * anim );
+bool animInsertFrame( Anim * anim, int at, Board * frame, int delay_ms );
+Board * animRemoveFrame( Anim * anim, int at );
+bool animSave( Anim * anim, char * filename );
+Anim * animLoad( char * filename );
+
+AnimClip * animCompile( Anim * anim );
+Anim * animFromClip( const AnimClip * clip );
+bool animClipSave( const AnimClip * clip, char * filename );
+AnimClip * animClipLoad( char * filename );
+AnimClip * animClipFromMemory( const unsigned char * data, size_t size, char * filename );
+void animClipFree( AnimClip * clip );
+
+AnimPlayer * animPlayerInit( const AnimClip * clip, int fps );
+void animPlayerFree( AnimPlayer * p );
+void animPlayerSeek( AnimPlayer * p, int frame );
+int animPlayerTick( AnimPlayer * p, long now_ms );
+long animPlayerWait( const AnimPlayer * p, long now_ms );
+
+#endif // ANIM_H
@@ -0,0 +1,162 @@
+#include "autosave.h"
+#include "profile.h"
+
+static void * autosaveWorker( void * arg ) {
+	Autosave * as = arg;
+	pthread_mutex_lock( &as->lock );
+	for( ;; ) {
+		while( !as->n_queued && !as->periodic.snap && !as->quit ) {
+			pthread_cond_wait( &as->wake, &as->lock );
+		}
+		// Explicit saves first; quit only once nothing is left.
+		AutosaveJob job;
+		if( as->n_queued ) {
+			job = as->queue[as->queue_head];
+			as->queue[as->queue_head].snap = NULL;
+			as->queue_head = ( as->queue_head + 1 ) % AUTOSAVE_QUEUE;
+			as->n_queued--;
+		}
+		else if( as->periodic.snap ) {
+			job = as->periodic;
+			as->periodic.snap = NULL;
+		}
+		else {
+			break;
+		}
+		pthread_mutex_unlock( &as->lock );
+
+		PROF_BEGIN( t_save );
+		boardSaveToFile( job.snap, job.name );
+		uint64_t ns = PROF_ELAPSED( t_save );
+		boardFree( job.snap );
+
+		pthread_mutex_lock( &as->lock );
+		if( as->n_save_ns < AUTOSAVE_TIMINGS ) {
+			as->save_ns[as->n_save_ns++] = ns;
+		}
+	}
+	pthread_mutex_unlock( &as->lock );
+	return NULL;
+}
+
+bool autosaveInit( Autosave * as ) {
+	memset( as, 0, sizeof(Autosave) );
+	as->last_save = time( NULL );
+	pthread_mutex_init( &as->lock, NULL );
+	pthread_cond_init( &as->wake, NULL );
+	if( pthread_create( &as->thread, NULL, autosaveWorker, as ) != 0 ) {
+		errLog( "autosaveInit(): pthread_create() failed; saving synchronously." );
+		return false;
+	}
+	as->running = true;
+	return true;
+}
+
+// Record the worker's finished saves in the profile, on the UI thread.
+static void recordSaves( Autosave * as ) {
+	uint64_t ns[AUTOSAVE_TIMINGS];
+	int i, n;
+	pthread_mutex_lock( &as->lock );
+	n = as->n_save_ns;
+	memcpy( ns, as->save_ns, n * sizeof(uint64_t) );
+	as->n_save_ns = 0;
+	pthread_mutex_unlock( &as->lock );
+	for( i = 0; i < n; i++ ) {
+		profRecord( PROF_SAVE, ns[i] );
+	}
+}
+
+// Finishes any queued save before returning.
+void autosaveShutdown( Autosave * as ) {
+	if( as->running ) {
+		pthread_mutex_lock( &as->lock );
+		as->quit = true;
+		pthread_cond_signal( &as->wake );
+		pthread_mutex_unlock( &as->lock );
+		pthread_join( as->thread, NULL );
+		as->running = false;
+		recordSaves( as );
+	}
+	pthread_cond_destroy( &as->wake );
+	pthread_mutex_destroy( &as->lock );
+}
+
+static bool saveNow( Board * board, const char * filename ) {
+	PROF_BEGIN( t_save );
+	bool ok = boardSaveToFile( board, (char *)filename );
+	PROF_END( t_save, PROF_SAVE );
+	return ok;
+}
+
+static bool requestSave( Autosave * as, Board * board, const char * filename, bool periodic ) {
+	if( strlen( filename ) >= AUTOSAVE_NAME_LEN ) {
+		errLog( "autosaveRequest(): file name too long: %s", filename );
+		return false;
+	}
+	as->last_save = time( NULL );
+	as->saved_generation = board->generation;
+	as->saved_id = board->id;
+
+	if( !as->running ) {
+		return saveNow( board, filename );
+	}
+
+	Board * snap = boardSnapshot( board );
+	if( !snap ) {
+		return false;
+	}
+	Board * stale = NULL;
+	AutosaveJob * job = NULL;
+	pthread_mutex_lock( &as->lock );
+	if( periodic ) {
+		// A newer periodic save replaces one the worker hadn't started on.
+		stale = as->periodic.snap;
+		job = &as->periodic;
+	}
+	else if( as->n_queued < AUTOSAVE_QUEUE ) {
+		job = &as->queue[( as->queue_head + as->n_queued ) % AUTOSAVE_QUEUE];
+		as->n_queued++;
+	}
+	if( job ) {
+		job->snap = snap;
+		strcpy( job->name, filename );
+		pthread_cond_signal( &as->wake );
+	}
+	pthread_mutex_unlock( &as->lock );
+
+	if( !job ) {
+		boardFree( snap );
+		return saveNow( board, filename );
+	}
+	boardFree( stale );
+	return true;
+}
+
+/*  Queue a save of board to filename and return immediately. Falls back to
+    a synchronous save if the worker isn't running or is behind. Returns
+    false only if the request could not be made.                          */
+bool autosaveRequest( Autosave * as, Board * board, const char * filename ) {
+	return requestSave( as, board, filename, false );
+}
+
+// Call once per frame: saves to <filename>.autosave every AUTOSAVE_INTERVAL
+// seconds, if the board changed since the last save. filename must be the
+// document's committed name, not one still being typed.
+void autosaveTick( Autosave * as, Board * board, const char * filename ) {
+	if( as->running ) {
+		recordSaves( as );
+	}
+	if( time( NULL ) - as->last_save < AUTOSAVE_INTERVAL ) {
+		return;
+	}
+	if( board->id == as->saved_id && board->generation == as->saved_generation ) {
+		as->last_save = time( NULL );
+		return;
+	}
+	char name[AUTOSAVE_NAME_LEN];
+	if( (size_t)snprintf( name, sizeof(name), "%s" AUTOSAVE_SUFFIX, filename ) >= sizeof(name) ) {
+		as->last_save = time( NULL );
+		return;
+	}
+	requestSave( as, board, name, true );
+}
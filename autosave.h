@@ -0,0 +1,55 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "board.h"
+
+#define AUTOSAVE_INTERVAL 60            // Seconds between periodic saves.
+#define AUTOSAVE_SUFFIX ".autosave"     // Periodic saves go to <filename><suffix>.
+#define AUTOSAVE_NAME_LEN 256
+#define AUTOSAVE_TIMINGS 16             // Save durations queued for the profile.
+#define AUTOSAVE_QUEUE 8                // Explicit saves waiting for the worker.
+
+typedef struct AutosaveJob_t {
+	Board * snap;                   // NULL for an empty slot.
+	char name[AUTOSAVE_NAME_LEN];
+} AutosaveJob;
+
+/*  Saves boards on a worker thread. A save request takes a snapshot of the
+    board (boardSnapshot(), no copying unless the board is edited while the
+    save runs) and hands it to the worker, which writes it with
+    boardSaveToFile(), which logs any failure. Explicit saves are queued
+    and all written, in order; if the queue is full the save is made on
+    the spot. A periodic save waits in a slot of its own, where only a
+    newer periodic save replaces it. Profile timers may only be recorded
+    from one thread, so the worker queues how long each save took, and the
+    UI thread records them as PROF_SAVE on its next autosaveTick().        */
+typedef struct Autosave_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running;
+	bool quit;
+
+	// Guarded by lock.
+	AutosaveJob queue[AUTOSAVE_QUEUE];      // Ring of n_queued from queue_head.
+	int queue_head;
+	int n_queued;
+	AutosaveJob periodic;
+	uint64_t save_ns[AUTOSAVE_TIMINGS];     // Finished saves not yet recorded.
+	int n_save_ns;
+
+	// UI thread only: periodic save bookkeeping.
+	time_t last_save;
+	unsigned long saved_generation;
+	uint64_t saved_id;      // Board ids, unlike addresses, are never reused.
+} Autosave;
+
+bool autosaveInit( Autosave * as );
+void autosaveShutdown( Autosave * as );
+bool autosaveRequest( Autosave * as, Board * board, const char * filename );
+void autosaveTick( Autosave * as, Board * board, const char * filename );
+
+#endif // AUTOSAVE_H
@@ -1,4 +1,14 @@
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+
 #include "board.h"
+#include "anim.h"
+#include "byte_order.h"
+#include "layer.h"
+#include "pack.h"
+#include "palette.h"
+#include "undo.h"
 
 bool outOfBounds( int x, int y, int w, int h ) {
 	return ( x < 0 || x > w - 1 || y < 0 || y > h - 1 );
@@ -7,149 +17,1166 @@ bool outOfBounds( int x, int y, int w, int h ) {
 
 Cell boardGetCell( Board * board, int x, int y ) {
 	if( outOfBounds( x, y, board->w, board->h ) ) {
-		Cell oob;
-		oob.pattern = CELL_OUT_OF_BOUNDS;
-		return oob;
+		return CELL_OUT_OF_BOUNDS;
 	}
 	else {
-		return board->cells[ x*board->h + y ];
+		return *boardCellPtr( board, x, y );
+	}
+}
+
+static inline Cell ** sparseTile( const Board * board, int x, int y ) {
+	return &board->tiles[ (size_t)( y >> BOARD_TILE_SHIFT ) * board->tiles_w + ( x >> BOARD_TILE_SHIFT ) ];
+}
+
+// True if storing c over the run at x, y (within one tile) can be skipped:
+// the run is in a sparse tile that is still empty, and c is its blank cell.
+static inline bool sparseSkip( const Board * board, int x, int y, Cell c ) {
+	return board->layout == BOARD_LAYOUT_SPARSE && *sparseTile( board, x, y ) == board->empty_tile && board->empty_tile[0] == c;
+}
+
+// As sparseSkip(), for a run of different cells.
+static bool sparseSkipRun( const Board * board, int x, int y, const Cell * cells, int len ) {
+	if( !sparseSkip( board, x, y, cells[0] ) ) {
+		return false;
+	}
+	int i;
+	for( i = 1; i < len && cells[i] == cells[0]; i++ );
+	return i == len;
+}
+
+// Writable pointer to the cell at an in-bounds x, y, giving a sparse tile
+// its own storage first, or NULL if that fails. The caller must have
+// called boardTouch().
+static Cell * cellForWrite( Board * board, int x, int y ) {
+	if( board->layout != BOARD_LAYOUT_SPARSE ) {
+		return &board->cells[ boardCellIndex( board, x, y ) ];
+	}
+	Cell ** t = sparseTile( board, x, y );
+	if( *t == board->empty_tile ) {
+		Cell * tile = malloc( BOARD_TILE_CELLS * sizeof(Cell) );
+		if( !tile ) {
+			errLogLimited( LOG_ERROR, "boardPutCell(): malloc() failed on sparse tile; write dropped" );
+			return NULL;
+		}
+		memcpy( tile, board->empty_tile, BOARD_TILE_CELLS * sizeof(Cell) );
+		*t = tile;
+		board->n_tiles++;
+	}
+	return *t + ( ( y & BOARD_TILE_MASK ) << BOARD_TILE_SHIFT ) + ( x & BOARD_TILE_MASK );
+}
+
+// Cells from x to the end of its row, or of its tile when tiled or sparse.
+static inline int spanRun( const Board * board, int x ) {
+	if( board->layout == BOARD_LAYOUT_LINEAR ) {
+		return board->w - x;
+	}
+	int run = BOARD_TILE_SIZE - ( x & BOARD_TILE_MASK );
+	return ( run < board->w - x ) ? run : board->w - x;
+}
+
+// Extend row y's dirty span to cover x0..x1. Coordinates must be in bounds.
+static void markDirtyRow( Board * board, int y, int x0, int x1 ) {
+	if( x0 < board->dirty_x0[y] ) {
+		board->dirty_x0[y] = x0;
+	}
+	if( x1 > board->dirty_x1[y] ) {
+		board->dirty_x1[y] = x1;
+	}
+	if( y < board->dirty_y0 ) {
+		board->dirty_y0 = y;
+	}
+	if( y > board->dirty_y1 ) {
+		board->dirty_y1 = y;
+	}
+}
+
+void boardMarkDirty( Board * board, int x, int y, int w, int h ) {
+	int x1 = x + w - 1;
+	int y1 = y + h - 1;
+	if( x < 0 ) {
+		x = 0;
+	}
+	if( y < 0 ) {
+		y = 0;
 	}
+	if( x1 > board->w - 1 ) {
+		x1 = board->w - 1;
+	}
+	if( y1 > board->h - 1 ) {
+		y1 = board->h - 1;
+	}
+	for( ; y <= y1 && x <= x1; y++ ) {
+		markDirtyRow( board, y, x, x1 );
+	}
+}
+
+void boardMarkAllDirty( Board * board ) {
+	boardMarkDirty( board, 0, 0, board->w, board->h );
+}
+
+// Rows outside dirty_y0..dirty_y1 are already clean, so only those are
+// reset; a new board must set the range to every row before the first call.
+void boardClearDirty( Board * board ) {
+	int y;
+	for( y = board->dirty_y0; y <= board->dirty_y1; y++ ) {
+		board->dirty_x0[y] = INT_MAX;
+		board->dirty_x1[y] = -1;
+	}
+	board->dirty_y0 = INT_MAX;
+	board->dirty_y1 = -1;
 }
 
 void boardPutCell( Board * board, Cell new_cell, int x, int y ) {
-	if( !outOfBounds( x, y, board->w, board->h ) ) {
-		board->cells[ x*board->h + y ] = new_cell;
+	if( !outOfBounds( x, y, board->w, board->h ) && !sparseSkip( board, x, y, new_cell ) ) {
+		Cell * c = boardTouch( board ) ? cellForWrite( board, x, y ) : NULL;
+		if( !c ) {
+			return;
+		}
+		if( board->journal ) {
+			undoRecordCell( board->journal, x, y, *c, new_cell );
+		}
+		*c = new_cell;
+		markDirtyRow( board, y, x, x );
+	}
+}
+
+// Returns the run of cells starting at x, y that are contiguous in memory
+// and on the same row. *len receives the run length (0 if out of bounds).
+const Cell * boardSpan( Board * board, int x, int y, int * len ) {
+	if( outOfBounds( x, y, board->w, board->h ) ) {
+		*len = 0;
+		return NULL;
+	}
+	*len = spanRun( board, x );
+	return boardCellPtr( board, x, y );
+}
+
+// As boardSpan(), for writing. The caller is responsible for dirty marking.
+// NULL (and *len 0) as well when the cells can't be made writable.
+Cell * boardSpanWritable( Board * board, int x, int y, int * len ) {
+	Cell * span = NULL;
+	if( !outOfBounds( x, y, board->w, board->h ) && boardTouch( board ) ) {
+		span = cellForWrite( board, x, y );
+	}
+	*len = span ? spanRun( board, x ) : 0;
+	return span;
+}
+
+// Store n copies of c. Simple enough for the compiler to vectorize.
+static inline void fillCells( Cell * dst, size_t n, Cell c ) {
+	Cell * end = dst + n;
+	while( dst < end ) {
+		*dst++ = c;
 	}
 }
 
 void boardWipe( Board * board, int wipe_pattern, int fg, int bg, int bright, int blink ) {
-	int x, y;
-	for( x = 0; x < board->w; x++ ) {
+	Cell empty = cellMake( wipe_pattern, fg, bg, bright, blink );
+	if( !boardTouch( board ) ) {
+		return;
+	}
+	if( board->journal ) {
+		int y;
 		for( y = 0; y < board->h; y++ ) {
-			Cell empty;
-			empty.pattern = wipe_pattern;
-			empty.fg = fg;
-			empty.bg = bg;
-			empty.bright = bright;
-			empty.blink = blink;
+			undoRecordSpan( board->journal, board, 0, y, board->w, NULL, empty );
+		}
+	}
+	if( board->layout == BOARD_LAYOUT_SPARSE ) {
+		// Back to all-empty: drop every tile and repaint the empty one.
+		size_t i, n = (size_t)board->tiles_w * ( ( board->h + BOARD_TILE_MASK ) >> BOARD_TILE_SHIFT );
+		for( i = 0; i < n; i++ ) {
+			if( board->tiles[i] != board->empty_tile ) {
+				free( board->tiles[i] );
+				board->tiles[i] = board->empty_tile;
+			}
+		}
+		board->n_tiles = 0;
+		fillCells( board->empty_tile, BOARD_TILE_CELLS, empty );
+	}
+	else {
+		fillCells( board->cells, board->n_alloc, empty );
+	}
+	boardMarkAllDirty( board );
+}
+
+/*  Clip the rect x, y, w, h to the board. Returns false if nothing is left.
+    The bulk writers below clip once with this and then work on raw spans,
+    with no per-cell bounds checks.                                       */
+bool boardClipRect( const Board * board, Rect * r ) {
+	int x1 = r->x + r->w;
+	int y1 = r->y + r->h;
+	if( r->x < 0 ) {
+		r->x = 0;
+	}
+	if( r->y < 0 ) {
+		r->y = 0;
+	}
+	if( x1 > board->w ) {
+		x1 = board->w;
+	}
+	if( y1 > board->h ) {
+		y1 = board->h;
+	}
+	r->w = x1 - r->x;
+	r->h = y1 - r->y;
+	return r->w > 0 && r->h > 0;
+}
+
+// Fill an already clipped run of row y. Returns false if a sparse tile
+// couldn't be allocated, leaving the rest of the run unwritten.
+static bool fillRowClipped( Board * board, int x, int y, int len, Cell c ) {
+	if( board->journal ) {
+		undoRecordSpan( board->journal, board, x, y, len, NULL, c );
+	}
+	if( board->layout == BOARD_LAYOUT_LINEAR ) {
+		fillCells( &board->cells[ boardCellIndex( board, x, y ) ], len, c );
+	}
+	else {
+		int i, run;
+		for( i = 0; i < len; i += run ) {
+			run = BOARD_TILE_SIZE - ( ( x + i ) & BOARD_TILE_MASK );
+			if( run > len - i ) {
+				run = len - i;
+			}
+			if( !sparseSkip( board, x + i, y, c ) ) {
+				Cell * dst = cellForWrite( board, x + i, y );
+				if( !dst ) {
+					if( i > 0 ) {
+						markDirtyRow( board, y, x, x + i - 1 );
+					}
+					return false;
+				}
+				fillCells( dst, run, c );
+			}
+		}
+	}
+	markDirtyRow( board, y, x, x + len - 1 );
+	return true;
+}
+
+void boardFillSpan( Board * board, int x, int y, int len, Cell c ) {
+	Rect r = { x, y, len, 1 };
+	if( boardClipRect( board, &r ) && boardTouch( board ) ) {
+		fillRowClipped( board, r.x, r.y, r.w, c );
+	}
+}
+
+void boardFillRect( Board * board, int x, int y, int w, int h, Cell c ) {
+	Rect r = { x, y, w, h };
+	if( !boardClipRect( board, &r ) || !boardTouch( board ) ) {
+		return;
+	}
+	for( y = r.y; y < r.y + r.h && fillRowClipped( board, r.x, y, r.w, c ); y++ );
+}
+
+// Box outline; the corners belong to the top and bottom rows.
+void boardDrawBox( Board * board, int x, int y, int w, int h, Cell c ) {
+	if( w < 1 || h < 1 ) {
+		return;
+	}
+	boardFillSpan( board, x, y, w, c );
+	if( h > 1 ) {
+		boardFillSpan( board, x, y + h - 1, w, c );
+	}
+	int i;
+	for( i = y + 1; i < y + h - 1; i++ ) {
+		boardFillSpan( board, x, i, 1, c );
+		if( w > 1 ) {
+			boardFillSpan( board, x + w - 1, i, 1, c );
+		}
+	}
+}
+
+// Bresenham line from x0, y0 to x1, y1 inclusive. Each row's run of cells
+// is written as one span, so shallow lines cost a span per row, not a cell.
+void boardDrawLine( Board * board, int x0, int y0, int x1, int y1, Cell c ) {
+	if( x0 > x1 ) {
+		int t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+	int dx = x1 - x0;
+	int dy = abs( y1 - y0 );
+	int sy = y0 < y1 ? 1 : -1;
+	int err = dx - dy;
+	int run_x = x0;
+	for( ;; ) {
+		if( x0 == x1 && y0 == y1 ) {
+			break;
+		}
+		int e2 = 2 * err;
+		bool step_y = e2 < dx;
+		if( e2 > -dy ) {
+			err -= dy;
+			x0++;
+		}
+		if( step_y ) {
+			// Leaving this row: flush its run. The x step (if any) has
+			// already happened, so the run ends at x0 - 1 or x0.
+			int end = ( e2 > -dy ) ? x0 - 1 : x0;
+			boardFillSpan( board, run_x, y0, end - run_x + 1, c );
+			err += dx;
+			y0 += sy;
+			run_x = x0;
+		}
+	}
+	boardFillSpan( board, run_x, y0, x1 - run_x + 1, c );
+}
+
+/*  Copy the w x h rect at sx, sy of src to dx, dy of dst. Both rects are
+    clipped up front; rows are then moved with memmove() a span at a time.
+    src and dst may be the same board, with overlapping rects. If key is
+    given, source cells equal to *key are transparent and left unwritten.
+    Every changed run is recorded in dst's undo journal. Glyphs are carried
+    over: an ASCII-only dst takes on src's glyph table, and when the two
+    tables disagree the patterns are translated a row at a time.          */
+static bool blit( Board * src, int sx, int sy, int w, int h, Board * dst, int dx, int dy, const Cell * key ) {
+	if( !src || !dst ) {
+		errLog( "boardBlit(): Supplied NULL pointer(s)." );
+		return false;
+	}
+	// Clip against the source, shifting the destination to match, then
+	// against the destination, shifting the source.
+	Rect r = { sx, sy, w, h };
+	if( !boardClipRect( src, &r ) ) {
+		return true;
+	}
+	dx += r.x - sx;
+	dy += r.y - sy;
+	sx = r.x;
+	sy = r.y;
+	r = (Rect){ dx, dy, r.w, r.h };
+	if( !boardClipRect( dst, &r ) ) {
+		return true;
+	}
+	sx += r.x - dx;
+	sy += r.y - dy;
+	dx = r.x;
+	dy = r.y;
+	w = r.w;
+	h = r.h;
+
+	// Unshare first: src may be dst, and its cells must not move under us.
+	if( !boardTouch( dst ) ) {
+		return false;
+	}
+
+	if( src->glyphs && !dst->glyphs ) {
+		dst->glyphs = glyphTableRetain( src->glyphs );
+	}
+	GlyphMap map;
+	bool remap = !glyphTablePrefixOf( src->glyphs, dst->glyphs );
+	if( remap ) {
+		glyphMapInit( &map, src->glyphs, dst->glyphs );
+	}
+
+	// One row of source cells, contiguous. Only needed when src rows are
+	// split across tiles, when src is dst (a row may be overwritten
+	// before it is read when the rects overlap), or when glyphs are
+	// translated.
+	Cell * row = NULL;
+	if( src->layout != BOARD_LAYOUT_LINEAR || src == dst || remap ) {
+		row = malloc( (size_t)w * sizeof(Cell) );
+		if( !row ) {
+			errLog( "boardBlit(): malloc() failed on %d cell row", w );
+			return false;
+		}
+	}
 
-			boardPutCell( board, empty, x, y );
+	// Copying downward within one board must go bottom-up so source rows
+	// are read before they are overwritten.
+	int first = 0, last = h, step = 1;
+	if( src == dst && dy > sy ) {
+		first = h - 1;
+		last = -1;
+		step = -1;
+	}
+	int j;
+	for( j = first; j != last; j += step ) {
+		const Cell * from;
+		int i, run;
+		if( row ) {
+			for( i = 0; i < w; i += run ) {
+				const Cell * p = boardSpan( src, sx + i, sy + j, &run );
+				if( run > w - i ) {
+					run = w - i;
+				}
+				memcpy( row + i, p, run * sizeof(Cell) );
+			}
+			from = row;
+		}
+		else {
+			from = &src->cells[ boardCellIndex( src, sx, sy + j ) ];
+		}
+
+		// Runs of opaque cells; the whole row when there is no key.
+		int x0 = 0;
+		while( x0 < w ) {
+			int x1 = w;
+			if( key ) {
+				while( x0 < w && from[x0] == *key ) {
+					x0++;
+				}
+				if( x0 == w ) {
+					break;
+				}
+				for( x1 = x0 + 1; x1 < w && from[x1] != *key; x1++ );
+			}
+			if( remap ) {
+				for( i = x0; i < x1; i++ ) {
+					row[i] = cellSetPattern( row[i], glyphMapIndex( &map, cellPattern( row[i] ) ) );
+				}
+			}
+			if( dst->journal ) {
+				undoRecordSpan( dst->journal, dst, dx + x0, dy + j, x1 - x0, from + x0, 0 );
+			}
+			for( i = x0; i < x1; i += run ) {
+				run = spanRun( dst, dx + i );
+				if( run > x1 - i ) {
+					run = x1 - i;
+				}
+				if( !sparseSkipRun( dst, dx + i, dy + j, from + i, run ) ) {
+					Cell * to = cellForWrite( dst, dx + i, dy + j );
+					if( !to ) {
+						markDirtyRow( dst, dy + j, dx + x0, dx + x1 - 1 );
+						free( row );
+						return false;
+					}
+					memmove( to, from + i, run * sizeof(Cell) );
+				}
+			}
+			markDirtyRow( dst, dy + j, dx + x0, dx + x1 - 1 );
+			x0 = x1;
 		}
 	}
+	free( row );
+	return true;
 }
 
-#define TEST_FILE "test_file.sav"
+bool boardBlit( Board * src, int sx, int sy, int w, int h, Board * dst, int dx, int dy ) {
+	return blit( src, sx, sy, w, h, dst, dx, dy, NULL );
+}
+
+bool boardBlitKeyed( Board * src, int sx, int sy, int w, int h, Board * dst, int dx, int dy, Cell key ) {
+	return blit( src, sx, sy, w, h, dst, dx, dy, &key );
+}
+
+// Layout boardInit() picks for a w x h board.
+static int layoutFor( int w, int h ) {
+	if( (uint64_t)w * h >= BOARD_SPARSE_MIN_CELLS ) {
+		return BOARD_LAYOUT_SPARSE;
+	}
+	if( w >= BOARD_TILED_MIN_W ) {
+		return BOARD_LAYOUT_TILED;
+	}
+	return BOARD_LAYOUT_LINEAR;
+}
 
 Board * boardInit( int w, int h, bool color ) {
+	return boardInitLayout( w, h, color, layoutFor( w, h ) );
+}
+
+static size_t sparseDirSize( const Board * board ) {
+	return (size_t)board->tiles_w * ( ( board->h + BOARD_TILE_MASK ) >> BOARD_TILE_SHIFT );
+}
+
+// Set the size and layout fields; n_alloc is the cells the layout needs.
+static void setGeometry( Board * board, int w, int h, int layout ) {
+	board->w = w;
+	board->h = h;
+	board->layout = layout;
+	if( layout == BOARD_LAYOUT_TILED ) {
+		int tiles_h = ( h + BOARD_TILE_MASK ) >> BOARD_TILE_SHIFT;
+		board->tiles_w = ( w + BOARD_TILE_MASK ) >> BOARD_TILE_SHIFT;
+		board->n_alloc = (size_t)board->tiles_w * tiles_h * BOARD_TILE_CELLS;
+	}
+	else if( layout == BOARD_LAYOUT_SPARSE ) {
+		board->tiles_w = ( w + BOARD_TILE_MASK ) >> BOARD_TILE_SHIFT;
+		board->n_alloc = 0;
+	}
+	else {
+		board->tiles_w = 0;
+		board->n_alloc = (size_t)w * h;
+	}
+}
+
+// Boards may be made on worker threads (brdtool's jobs).
+static uint64_t nextBoardId( void ) {
+	static atomic_uint_fast64_t next_id = 1;
+	return atomic_fetch_add( &next_id, 1 );
+}
+
+/*  One allocation holding the board, then dirty_x0[h] and dirty_x1[h],
+    then n_cells cells (which cells points at, if there are any). All other
+    fields are zero.                                                       */
+static Board * allocBlock( int h, size_t n_cells ) {
+	size_t head = sizeof(Board) + (size_t)h * 2 * sizeof(int);
+	Board * board = malloc( head + n_cells * sizeof(Cell) );
+	if( !board ) {
+		return NULL;
+	}
+	memset( board, 0, sizeof(Board) );
+	board->id = nextBoardId();
+	board->dirty_x0 = (int *)( board + 1 );
+	board->dirty_x1 = board->dirty_x0 + h;
+	board->cap_h = h;
+	if( n_cells ) {
+		board->cells = (Cell *)( (char *)board + head );
+		board->cells_inline = true;
+		board->cap_cells = n_cells;
+	}
+	return board;
+}
+
+/*  A board whose cells are left unwritten, all marked dirty: for callers
+    that are about to write every cell anyway (loaders, copies), which
+    would only overwrite boardInit()'s wipe. Sparse boards come back blank,
+    as that costs nothing.                                                 */
+static Board * allocLayout( int w, int h, bool color, int layout ) {
 	if( w < 1 || h < 1 ) {
 		errLog( "boardInit(): invalid dimensions." );
 		return NULL;
-		exit(1);
 	}
 
-	Board * new_board = malloc( sizeof(Board) );
+	Board geometry;
+	setGeometry( &geometry, w, h, layout );
+	Board * new_board = allocBlock( h, geometry.n_alloc );
 	if( !new_board ) {
-		errLog( "boardInit(): malloc() failed on new_board" );
+		errLog( "boardInit(): malloc() failed on a %dx%d board", w, h );
 		return NULL;
 	}
-
-	new_board->w = w;
-	new_board->h = h;
+	setGeometry( new_board, w, h, layout );
 	new_board->color_enabled = color;
 
-	new_board->filename = malloc( sizeof(TEST_FILE) );
-	if( !new_board->filename ) {
-		errLog( "boardInit(): malloc() failed on new_board->filename" );
+	if( layout == BOARD_LAYOUT_SPARSE ) {
+		size_t i, n = sparseDirSize( new_board );
+		new_board->tiles = malloc( n * sizeof(Cell *) );
+		new_board->empty_tile = malloc( BOARD_TILE_CELLS * sizeof(Cell) );
+		if( !new_board->tiles || !new_board->empty_tile ) {
+			errLog( "boardInit(): malloc() failed on sparse tile directory" );
+			free( new_board->tiles );
+			free( new_board->empty_tile );
+			free( new_board );
+			return NULL;
+		}
+		fillCells( new_board->empty_tile, BOARD_TILE_CELLS, cellMake( ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 ) );
+		for( i = 0; i < n; i++ ) {
+			new_board->tiles[i] = new_board->empty_tile;
+		}
+	}
+
+	new_board->dirty_y0 = 0;
+	new_board->dirty_y1 = h - 1;
+	boardClearDirty( new_board );
+	boardMarkAllDirty( new_board );
+	return new_board;
+}
+
+Board * boardAlloc( int w, int h, bool color ) {
+	return allocLayout( w, h, color, layoutFor( w, h ) );
+}
+
+Board * boardInitLayout( int w, int h, bool color, int layout ) {
+	Board * new_board = allocLayout( w, h, color, layout );
+	if( new_board ) {
+		boardWipe( new_board, ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	}
+	return new_board;
+}
+
+/*  Reuse board for w x h, as boardAlloc() would return it, if its own
+    allocation has room: for pools of scratch boards. Only boards with
+    their cells inline and no snapshots, journal or pin qualify, and only
+    for sizes that don't need the sparse layout.                          */
+bool boardReshape( Board * board, int w, int h, bool color ) {
+	int layout = layoutFor( w, h );
+	if( w < 1 || h < 1 || layout == BOARD_LAYOUT_SPARSE || h > board->cap_h
+		|| !board->cells_inline || board->share || board->pin || board->journal ) {
+		return false;
+	}
+	Board geometry;
+	setGeometry( &geometry, w, h, layout );
+	if( geometry.n_alloc > board->cap_cells ) {
+		return false;
+	}
+	// Clear the old rows while the old height still says which they are.
+	boardClearDirty( board );
+	setGeometry( board, w, h, layout );
+	board->color_enabled = color;
+	board->id = nextBoardId();
+	board->generation++;
+	glyphTableRelease( board->glyphs );
+	board->glyphs = NULL;
+	boardMarkAllDirty( board );
+	return true;
+}
+
+// Bytes of heap held by a board, for budgets and reporting.
+size_t boardMemoryUsage( const Board * board ) {
+	size_t cells = board->n_alloc * sizeof(Cell);
+	if( board->layout == BOARD_LAYOUT_SPARSE ) {
+		cells = sparseDirSize( board ) * sizeof(Cell *) + ( board->n_tiles + 1 ) * BOARD_TILE_CELLS * sizeof(Cell);
+	}
+	else if( board->cells_inline ) {
+		cells = board->cap_cells * sizeof(Cell);
+	}
+	size_t glyphs = board->glyphs ? sizeof(GlyphTable) : 0;
+	return sizeof(Board) + cells + glyphs + (size_t)board->cap_h * 2 * sizeof(int);
+}
+
+// Free the board's cell storage (the array, or a sparse board's tiles).
+static void freeCells( Board * board ) {
+	if( board->tiles ) {
+		size_t i, n = sparseDirSize( board );
+		for( i = 0; i < n; i++ ) {
+			if( board->tiles[i] != board->empty_tile ) {
+				free( board->tiles[i] );
+			}
+		}
+	}
+	free( board->tiles );
+	free( board->empty_tile );
+	if( !board->cells_inline ) {
+		free( board->cells );
+	}
+	board->tiles = NULL;
+	board->empty_tile = NULL;
+	board->cells = NULL;
+}
+
+// Drop this board's reference to shared cell storage, freeing it if this
+// was the last one. Not for the board whose allocation holds the cells
+// (share->block), which boardUnshare() and boardFree() deal with.
+static void releaseShare( Board * board ) {
+	if( board->share->map.data ) {
+		cellShareRelease( board->share );
+	}
+	else if( atomic_fetch_sub( &board->share->refs, 1 ) == 1 ) {
+		Board * block = board->share->block;
+		free( board->share );
+		if( block ) {
+			free( block );
+		}
+		else {
+			freeCells( board );
+		}
+	}
+	board->share = NULL;
+	board->cells = NULL;
+	board->tiles = NULL;
+	board->empty_tile = NULL;
+}
+
+// Deep copy of a sparse board's tiles: only the written tiles are copied.
+// On failure nothing changes and false is returned.
+static bool unshareSparse( Board * board ) {
+	size_t i, n = sparseDirSize( board );
+	Cell ** tiles = calloc( n, sizeof(Cell *) );
+	Cell * empty = malloc( BOARD_TILE_CELLS * sizeof(Cell) );
+	if( !tiles || !empty ) {
+		errLogLimited( LOG_ERROR, "boardUnshare(): malloc() failed on sparse tile directory; write dropped" );
+		free( tiles );
+		free( empty );
+		return false;
+	}
+	memcpy( empty, board->empty_tile, BOARD_TILE_CELLS * sizeof(Cell) );
+	for( i = 0; i < n; i++ ) {
+		if( board->tiles[i] == board->empty_tile ) {
+			tiles[i] = empty;
+			continue;
+		}
+		tiles[i] = malloc( BOARD_TILE_CELLS * sizeof(Cell) );
+		if( !tiles[i] ) {
+			errLogLimited( LOG_ERROR, "boardUnshare(): malloc() failed on sparse tile; write dropped" );
+			while( i-- > 0 ) {
+				if( tiles[i] != empty ) {
+					free( tiles[i] );
+				}
+			}
+			free( tiles );
+			free( empty );
+			return false;
+		}
+		memcpy( tiles[i], board->tiles[i], BOARD_TILE_CELLS * sizeof(Cell) );
+	}
+	releaseShare( board );
+	board->tiles = tiles;
+	board->empty_tile = empty;
+	return true;
+}
+
+/*  Give the board a private cell array before it is written. If every
+    snapshot is already gone the board just takes the array back; otherwise
+    it copies it, which happens at most once per snapshot. Returns false if
+    the copy can't be allocated; the board stays shared and readable.     */
+bool boardUnshare( Board * board ) {
+	CellShare * share = board->share;
+	if( !share->map.data && ( !share->block || share->block == board ) && atomic_load( &share->refs ) == 1 ) {
+		free( share );
+		board->share = NULL;
+		return true;
+	}
+	if( board->layout == BOARD_LAYOUT_SPARSE ) {
+		return unshareSparse( board );
+	}
+	Cell * copy = malloc( board->n_alloc * sizeof(Cell) );
+	if( !copy ) {
+		errLogLimited( LOG_ERROR, "boardUnshare(): malloc() failed on %zu cells; write dropped", board->n_alloc );
+		return false;
+	}
+	memcpy( copy, board->cells, board->n_alloc * sizeof(Cell) );
+	if( share->block == board ) {
+		// Snapshots still read the cells inside this board's allocation, so
+		// it must outlive them: keep the reference until boardFree().
+		board->pin = share;
+		board->share = NULL;
+		board->cells_inline = false;
+	}
+	else {
+		releaseShare( board );
+	}
+	board->cells = copy;
+	return true;
+}
+
+/*  A read-only copy of the board's cells that costs no copying up front:
+    the snapshot and the board share one cell array until the board is next
+    written. Snapshots are safe to read (save, export) from another thread,
+    and must be released with boardFree().                                 */
+Board * boardSnapshot( Board * board ) {
+	Board * snap = malloc( sizeof(Board) );
+	if( !snap ) {
+		errLog( "boardSnapshot(): malloc() failed on snapshot" );
 		return NULL;
 	}
-	strncpy( new_board->filename, TEST_FILE, sizeof( TEST_FILE ) );
+	if( !board->share ) {
+		board->share = malloc( sizeof(CellShare) );
+		if( !board->share ) {
+			errLog( "boardSnapshot(): malloc() failed on share" );
+			free( snap );
+			return NULL;
+		}
+		atomic_init( &board->share->refs, 1 );
+		board->share->map.data = NULL;
+		board->share->block = board->cells_inline ? board : NULL;
+	}
+	atomic_fetch_add( &board->share->refs, 1 );
 
-	new_board->cells = malloc( (new_board->w * new_board->h) * sizeof(Cell) );
-	if( !new_board->cells ) {
-		errLog( "boardInit(): malloc() failed on new_board->cells" );
-		exit(1);
+	*snap = *board;
+	glyphTableRetain( snap->glyphs );
+	snap->journal = NULL;
+	snap->dirty_x0 = NULL;
+	snap->dirty_x1 = NULL;
+	snap->cells_inline = false;
+	snap->cap_h = 0;
+	snap->cap_cells = 0;
+	snap->pin = NULL;
+	return snap;
+}
+
+// A share that owns a mapped file, with one reference held by the caller.
+// Takes over fm.
+CellShare * cellShareFromMap( FileMap * fm ) {
+	CellShare * share = malloc( sizeof(CellShare) );
+	if( !share ) {
+		errLog( "cellShareFromMap(): malloc() failed on share" );
 		return NULL;
 	}
-	
-	boardWipe( new_board, ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	atomic_init( &share->refs, 1 );
+	share->map = *fm;
+	share->block = NULL;
+	return share;
+}
 
-	return new_board;
+// Drop one reference to a mapped share, closing the map with the last.
+void cellShareRelease( CellShare * share ) {
+	if( atomic_fetch_sub( &share->refs, 1 ) == 1 ) {
+		fileMapClose( &share->map );
+		free( share );
+	}
 }
 
 void boardFree( Board * board ) {
 	if( board ) {
-		free( board->cells );
-		free( board->filename );
+		// While snapshots read cells inside this allocation, the last of
+		// them frees it.
+		CellShare * pin = board->pin;
+		if( board->share && board->share->block == board ) {
+			pin = board->share;
+		}
+		else if( board->share ) {
+			releaseShare( board );
+		}
+		freeCells( board );
+		glyphTableRelease( board->glyphs );
+		if( pin && atomic_fetch_sub( &pin->refs, 1 ) != 1 ) {
+			return;
+		}
+		free( pin );
 		free( board );
 	}
 }
 
-void boardDraw( Board * board, Coord offset, bool draw_border ) {
-	int x, y;
-	Cell current;
-	for( x = 0; x < board->w; x++ ) {
-		for( y = 0; y < board->h; y++ ) {
-			current = boardGetCell( board, x, y );
-			colorSet( current.fg, current.bg, current.bright, current.blink );
-			mvaddch( y + offset.y, x + offset.x, current.pattern );
+bool sameCells( Cell a, Cell b ) {
+	return a == b;
+}
+
+// Pattern for code point cp on this board, interning it on first use. When
+// the board's table is full the glyph is drawn as GLYPH_REPLACEMENT.
+int boardInternGlyph( Board * board, uint32_t cp ) {
+	if( cp >= GLYPH_ASCII_END && !board->glyphs ) {
+		board->glyphs = glyphTableNew();
+		if( !board->glyphs ) {
+			return GLYPH_REPLACEMENT;
 		}
 	}
-	if( draw_border ) {
-		colorSet( COLOR_BLACK, COLOR_BLACK, 1, 0 );
-		for( x = 0; x < board->w; x++ ) {
-			//top
-			mvaddch( offset.y - 1,        x + offset.x, '-' );
-			//bottom
-			mvaddch( offset.y + board->h, x + offset.x, '-' );
+	int index = glyphIntern( board->glyphs, cp );
+	return index < 0 ? GLYPH_REPLACEMENT : index;
+}
+
+uint32_t boardGlyphCodePoint( const Board * board, int index ) {
+	return glyphCodePoint( board->glyphs, index );
+}
+
+static inline uint64_t fnvWord( uint64_t h, uint32_t v ) {
+	int i;
+	for( i = 0; i < 4; i++ ) {
+		h = ( h ^ ( ( v >> ( i * 8 ) ) & 0xff ) ) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+/*  64-bit FNV-1a over the size and every cell, row-major, with patterns
+    taken as code points: boards that look the same have the same sum,
+    whatever their layout or glyph table order.                          */
+uint64_t boardChecksum( Board * board ) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	int x, y, i, len;
+	h = fnvWord( h, board->w );
+	h = fnvWord( h, board->h );
+	for( y = 0; y < board->h; y++ ) {
+		for( x = 0; x < board->w; x += len ) {
+			const Cell * c = boardSpan( board, x, y, &len );
+			for( i = 0; i < len; i++ ) {
+				h = fnvWord( h, cellSetPattern( c[i], 0 ) );
+				h = fnvWord( h, boardGlyphCodePoint( board, cellPattern( c[i] ) ) );
+			}
 		}
-		for( y = 0; y < board->h; y++ ) {
-			//left
-			mvaddch( y + offset.y, offset.x - 1,           '|' );
-			//right
-			mvaddch( y + offset.y, offset.x + board->w,    '|' );
+	}
+	return h;
+}
+
+// Work stack for floodFill(): seeds are (x, y) points known to hold the
+// color being replaced. Lives on the heap so deep fills can't overflow the
+// C stack.
+typedef struct FillStack_t {
+	Coord * items;
+	size_t count;
+	size_t cap;
+} FillStack;
+
+static bool fillPush( FillStack * st, int x, int y ) {
+	if( st->count == st->cap ) {
+		size_t cap = st->cap ? st->cap * 2 : 256;
+		Coord * items = realloc( st->items, cap * sizeof(Coord) );
+		if( !items ) {
+			errLog( "floodFill(): realloc() failed growing work stack to %zu entries", cap );
+			return false;
 		}
-		//corners
-		mvaddch( offset.y - 1,        offset.x - 1, '+' );
-		mvaddch( offset.y + board->h, offset.x - 1, '+' );
-		mvaddch( offset.y + board->h, offset.x + board->w, '+' );
-		mvaddch( offset.y - 1,        offset.x + board->w, '+' );
+		st->items = items;
+		st->cap = cap;
 	}
+	st->items[st->count].x = x;
+	st->items[st->count].y = y;
+	st->count++;
+	return true;
 }
 
-bool sameCells( Cell a, Cell b ) {
-	bool retval = false;
+// Push one seed for each run of 'first' cells on row y between x0 and x1.
+static bool fillScanRow( Board * board, FillStack * st, Cell first, int x0, int x1, int y ) {
+	bool in_run = false;
+	int x;
+	if( y < 0 || y > board->h - 1 ) {
+		return true;
+	}
+	if( x0 < 0 ) {
+		x0 = 0;
+	}
+	if( x1 > board->w - 1 ) {
+		x1 = board->w - 1;
+	}
+	for( x = x0; x <= x1; x++ ) {
+		if( *boardCellPtr( board, x, y ) == first ) {
+			if( !in_run && !fillPush( st, x, y ) ) {
+				return false;
+			}
+			in_run = true;
+		}
+		else {
+			in_run = false;
+		}
+	}
+	return true;
+}
+
+/*  Scanline flood fill. Replaces the region of 'first' cells connected to
+    x, y with 'second'. connectivity is 4 (edges only) or 8 (edges and
+    corners). Returns the number of cells changed, and if changed is not
+    NULL, their bounding box (w/h of 0 when nothing changed).             */
+int floodFill( Board * board, Cell first, Cell second, int x, int y, int connectivity, Rect * changed ) {
+	int count = 0;
+	int bx0 = INT_MAX, by0 = INT_MAX, bx1 = -1, by1 = -1;
+	int diag = ( connectivity == 8 ) ? 1 : 0;
+	FillStack st = { NULL, 0, 0 };
+
+	if( first != second && !outOfBounds( x, y, board->w, board->h ) && fillPush( &st, x, y ) ) {
+		while( st.count > 0 ) {
+			st.count--;
+			int sx = st.items[st.count].x;
+			int sy = st.items[st.count].y;
+			if( *boardCellPtr( board, sx, sy ) != first ) {
+				continue;
+			}
 
-	if( a.pattern == b.pattern
-		&& a.fg == b.fg
-		&& a.bg == b.bg
-		&& a.bright == b.bright
-		&& a.blink == b.blink ) {
-			retval = true;
+			// Extend to the whole run on this row and fill it.
+			int lx = sx, rx = sx;
+			while( lx > 0 && *boardCellPtr( board, lx - 1, sy ) == first ) {
+				lx--;
+			}
+			while( rx < board->w - 1 && *boardCellPtr( board, rx + 1, sy ) == first ) {
+				rx++;
+			}
+			// A write that fails leaves cells equal to first, which would be
+			// found again and again: stop there.
+			if( !boardTouch( board ) || !fillRowClipped( board, lx, sy, rx - lx + 1, second ) ) {
+				break;
+			}
+
+			count += rx - lx + 1;
+			bx0 = lx < bx0 ? lx : bx0;
+			bx1 = rx > bx1 ? rx : bx1;
+			by0 = sy < by0 ? sy : by0;
+			by1 = sy > by1 ? sy : by1;
+
+			if( !fillScanRow( board, &st, first, lx - diag, rx + diag, sy - 1 )
+				|| !fillScanRow( board, &st, first, lx - diag, rx + diag, sy + 1 ) ) {
+				break;
+			}
+		}
 	}
+	free( st.items );
 
-	return retval;
+	if( changed ) {
+		if( count > 0 ) {
+			changed->x = bx0;
+			changed->y = by0;
+			changed->w = bx1 - bx0 + 1;
+			changed->h = by1 - by0 + 1;
+		}
+		else {
+			changed->x = x;
+			changed->y = y;
+			changed->w = 0;
+			changed->h = 0;
+		}
+	}
+	return count;
 }
 
-void floodFill( Board * board, Cell first, Cell second, int x, int y ) {
-	if( !outOfBounds( x, y, board->w, board->h ) ) {
-	
-		Cell check = boardGetCell( board, x, y );
+// Copy n_cells Cell words to/from the little-endian file payload.
+static void cellsToFile( unsigned char * out, const Cell * cells, size_t n_cells ) {
+#ifdef BRD_HOST_IS_LE
+	memcpy( out, cells, n_cells * sizeof(Cell) );
+#else
+	size_t i;
+	for( i = 0; i < n_cells; i++ ) {
+		putU32LE( out + i*4, cells[i] );
+	}
+#endif
+}
 
-		if( sameCells( check, first ) && !sameCells( first, second ) ) {
-			boardPutCell( board, second, x, y );
+static void cellsFromFile( Cell * cells, const unsigned char * in, size_t n_cells ) {
+#ifdef BRD_HOST_IS_LE
+	memcpy( cells, in, n_cells * sizeof(Cell) );
+#else
+	size_t i;
+	for( i = 0; i < n_cells; i++ ) {
+		cells[i] = getU32LE( in + i*4 );
+	}
+#endif
+}
+
+/*  Saves are written to "<filename>.tmp", which is renamed over the
+    destination only after it has been fully written and closed, so a crash
+    mid-save never leaves a truncated board behind. Other file formats
+    (packs, animations) save through the same pair.                        */
+#define SAVE_TMP_SUFFIX ".tmp"
 
-			floodFill( board, first, second, x - 1, y );
-			floodFill( board, first, second, x + 1, y );
-			floodFill( board, first, second, x, y - 1 );
-			floodFill( board, first, second, x, y + 1 );
+FILE * saveOpen( const char * filename, char * tmp_name, size_t tmp_len, const char * mode ) {
+	if( (size_t)snprintf( tmp_name, tmp_len, "%s" SAVE_TMP_SUFFIX, filename ) >= tmp_len ) {
+		errLog( "saveOpen(): file name too long: %s", filename );
+		return NULL;
+	}
+	FILE * f = fopen( tmp_name, mode );
+	if( !f ) {
+		errLog( "saveOpen(): Could not open %s for writing", tmp_name );
+	}
+	return f;
+}
+
+bool saveClose( FILE * f, const char * tmp_name, const char * filename, bool ok ) {
+	if( ferror( f ) ) {
+		ok = false;
+	}
+	if( fclose( f ) != 0 ) {
+		ok = false;
+	}
+	if( ok && rename( tmp_name, filename ) != 0 ) {
+		errLog( "saveClose(): Could not rename %s to %s", tmp_name, filename );
+		ok = false;
+	}
+	if( !ok ) {
+		errLog( "saveClose(): Write error on %s", filename );
+		remove( tmp_name );
+	}
+	return ok;
+}
+
+// Glyphs a save writes: read once (acquire, pairing with glyphIntern()),
+// since a snapshot's table is shared with a board that may still be
+// interning.
+static int savedGlyphs( const Board * brd ) {
+	return brd->glyphs ? atomic_load_explicit( &brd->glyphs->n, memory_order_acquire ) : 0;
+}
+
+static void putHeader( unsigned char * buf, const Board * brd, int n_glyphs ) {
+	memcpy( buf, BRD_MAGIC, BRD_MAGIC_LEN );
+	putU16LE( buf + 4, BRD_VERSION );
+	putU16LE( buf + 6, BRD_FLAG_ROW_MAJOR | ( brd->color_enabled ? BRD_FLAG_COLOR : 0 ) | ( n_glyphs ? BRD_FLAG_GLYPHS : 0 ) );
+	putU32LE( buf + 8, brd->w );
+	putU32LE( buf + 12, brd->h );
+}
+
+// Row y in file order, via spans so it works for any layout.
+static unsigned char * rowToFile( unsigned char * out, Board * brd, int y ) {
+	int x, run;
+	for( x = 0; x < brd->w; x += run ) {
+		const Cell * span = boardSpan( brd, x, y, &run );
+		cellsToFile( out, span, run );
+		out += (size_t)run * 4;
+	}
+	return out;
+}
+
+// The glyph table trailer: u32 count, then the code points.
+static size_t glyphsFileSize( int n_glyphs ) {
+	return n_glyphs ? 4 + (size_t)n_glyphs * 4 : 0;
+}
+
+static unsigned char * glyphsToFile( unsigned char * out, const Board * brd, int n_glyphs ) {
+	int i;
+	if( n_glyphs ) {
+		putU32LE( out, n_glyphs );
+		out += 4;
+		for( i = 0; i < n_glyphs; i++, out += 4 ) {
+			putU32LE( out, brd->glyphs->cp[i] );
 		}
 	}
+	return out;
 }
 
+// Size of brd as written by boardWriteBinary().
+uint64_t boardBinarySize( const Board * brd ) {
+	return BRD_HEADER_SIZE + (uint64_t)brd->w * brd->h * 4 + glyphsFileSize( savedGlyphs( brd ) );
+}
+
+/*  Write brd as a complete .brd v2 file to f, a row at a time, so it works
+    for any layout and needs only one row of buffer: a sparse board can be
+    far bigger than its memory footprint. Writes exactly
+    boardBinarySize() bytes.                                              */
+bool boardWriteBinary( Board * brd, FILE * f ) {
+	int n_glyphs = savedGlyphs( brd );
+	size_t len = (size_t)brd->w * 4;
+	size_t buf_len = len > BRD_HEADER_SIZE ? len : BRD_HEADER_SIZE;
+	if( buf_len < glyphsFileSize( n_glyphs ) ) {
+		buf_len = glyphsFileSize( n_glyphs );
+	}
+	unsigned char * buf = malloc( buf_len );
+	if( !buf ) {
+		errLog( "boardWriteBinary(): malloc() failed on %zu byte buffer", buf_len );
+		return false;
+	}
+	putHeader( buf, brd, n_glyphs );
+	bool ok = fwrite( buf, 1, BRD_HEADER_SIZE, f ) == BRD_HEADER_SIZE;
+	int y;
+	for( y = 0; y < brd->h && ok; y++ ) {
+		rowToFile( buf, brd, y );
+		ok = fwrite( buf, 1, len, f ) == len;
+	}
+	if( ok && n_glyphs ) {
+		glyphsToFile( buf, brd, n_glyphs );
+		ok = fwrite( buf, 1, glyphsFileSize( n_glyphs ), f ) == glyphsFileSize( n_glyphs );
+	}
+	free( buf );
+	return ok;
+}
+
+static bool saveSparse( Board * brd, char * filename ) {
+	char tmp_name[FILENAME_MAX];
+	FILE * f = saveOpen( filename, tmp_name, sizeof(tmp_name), "wb" );
+	if( !f ) {
+		return false;
+	}
+	bool ok = boardWriteBinary( brd, f );
+	return saveClose( f, tmp_name, filename, ok );
+}
+
+// Writes the binary .brd v2 format. The payload is built in one buffer and
+// written with a single fwrite().
 bool boardSaveToFile( Board * brd, char * filename ) {
-	FILE * f = fopen ( filename, "w" );
+	if( brd->layout == BOARD_LAYOUT_SPARSE ) {
+		return saveSparse( brd, filename );
+	}
+	int n_glyphs = savedGlyphs( brd );
+	size_t n_cells = (size_t)brd->w * brd->h;
+	size_t len = BRD_HEADER_SIZE + n_cells * 4 + glyphsFileSize( n_glyphs );
+	unsigned char * buf = malloc( len );
+	if( !buf ) {
+		errLog( "boardSaveToFile(): malloc() failed on %zu byte buffer", len );
+		return false;
+	}
+
+	putHeader( buf, brd, n_glyphs );
+	unsigned char * out = buf + BRD_HEADER_SIZE;
+	if( brd->layout == BOARD_LAYOUT_LINEAR ) {
+		cellsToFile( out, brd->cells, n_cells );
+		out += n_cells * 4;
+	}
+	else {
+		int y;
+		for( y = 0; y < brd->h; y++ ) {
+			out = rowToFile( out, brd, y );
+		}
+	}
+	glyphsToFile( out, brd, n_glyphs );
+
+	char tmp_name[FILENAME_MAX];
+	FILE * f = saveOpen( filename, tmp_name, sizeof(tmp_name), "wb" );
+	if( !f ) {
+		free( buf );
+		return false;
+	}
+	bool ok = fwrite( buf, 1, len, f ) == len;
+	free( buf );
+	return saveClose( f, tmp_name, filename, ok );
+}
+
+// Writes the legacy text format: w, h, color_enabled, then five decimal
+// lines (pattern, fg, bg, bright, blink) per cell in column order. The
+// pattern is written as its code point, so ASCII boards are unchanged.
+bool boardSaveToTextFile( Board * brd, char * filename ) {
+	char tmp_name[FILENAME_MAX];
+	FILE * f = saveOpen( filename, tmp_name, sizeof(tmp_name), "w" );
 	if( !f ) {
-		errLog( "boardSaveToFile(): Could not open %s for writing", filename );
 		return false;
 	}
 	fprintf( f, "%d\n%d\n%d\n", brd->w, brd->h, brd->color_enabled );
@@ -160,98 +1187,404 @@ bool boardSaveToFile( Board * brd, char * filename ) {
 
 			Cell work = boardGetCell( brd, x, y );
 
-			fprintf( f, "%d\n", work.pattern );
-			fprintf( f, "%d\n", work.fg );
-			fprintf( f, "%d\n", work.bg );
-			fprintf( f, "%d\n", work.bright );
-			fprintf( f, "%d\n", work.blink );
+			fprintf( f, "%u\n", (unsigned)boardGlyphCodePoint( brd, cellPattern( work ) ) );
+			fprintf( f, "%d\n", cellFg( work ) );
+			fprintf( f, "%d\n", cellBg( work ) );
+			fprintf( f, "%d\n", cellBright( work ) );
+			fprintf( f, "%d\n", cellBlink( work ) );
+		}
+	}
+	return saveClose( f, tmp_name, filename, true );
+}
+
+// Validate a binary header and check the payload is all there.
+static bool checkBinary( const unsigned char * data, size_t size, char * filename, uint32_t * w, uint32_t * h, unsigned int * flags ) {
+	if( size < BRD_HEADER_SIZE ) {
+		errLog( "boardLoadFromFile(): %s is truncated (no header)", filename );
+		return false;
+	}
+	if( memcmp( data, BRD_MAGIC, BRD_MAGIC_LEN ) != 0 ) {
+		errLog( "boardLoadFromFile(): %s is not a binary board", filename );
+		return false;
+	}
+	unsigned int version = getU16LE( data + 4 );
+	*flags = getU16LE( data + 6 );
+	*w = getU32LE( data + 8 );
+	*h = getU32LE( data + 12 );
+
+	if( version != BRD_VERSION ) {
+		errLog( "boardLoadFromFile(): %s has unsupported version %u", filename, version );
+		return false;
+	}
+	if( *w < 1 || *h < 1 || *w > INT_MAX || *h > INT_MAX || (uint64_t)*w * *h > ( SIZE_MAX - BRD_HEADER_SIZE ) / 4 ) {
+		errLog( "boardLoadFromFile(): invalid dimensions (w%u h%u) on %s", *w, *h, filename );
+		return false;
+	}
+	size_t n_cells = (size_t)*w * *h;
+	if( size < BRD_HEADER_SIZE + n_cells * 4 ) {
+		errLog( "boardLoadFromFile(): %s is truncated (%zu of %zu bytes)", filename, size, BRD_HEADER_SIZE + n_cells * 4 );
+		return false;
+	}
+	if( *flags & BRD_FLAG_GLYPHS ) {
+		size_t at = BRD_HEADER_SIZE + n_cells * 4;
+		uint32_t n = size - at >= 4 ? getU32LE( data + at ) : 0;
+		if( n < 1 || n > GLYPH_TABLE_SIZE || size - at < glyphsFileSize( n ) ) {
+			errLog( "boardLoadFromFile(): %s has a truncated or oversized glyph table", filename );
+			return false;
 		}
 	}
-	fclose( f );
 	return true;
 }
 
-Board * boardLoadFromFile( char * filename ) {
-//bool boardLoadFromFile( Board * brd, char * filename ) {
-	FILE * f = fopen( filename, "r" );
-	if( !f ) {
-		errLog( "boardLoadFromFile(): Could not load %s", filename );
+// Give brd the glyph table stored after its payload, if the file has one.
+// checkBinary() has checked it fits.
+static bool glyphsFromFile( Board * brd, const unsigned char * data, unsigned int flags, char * filename ) {
+	if( !( flags & BRD_FLAG_GLYPHS ) ) {
+		return true;
+	}
+	const unsigned char * in = data + BRD_HEADER_SIZE + (size_t)brd->w * brd->h * 4;
+	uint32_t i, n = getU32LE( in );
+	brd->glyphs = glyphTableNew();
+	if( !brd->glyphs ) {
 		return false;
 	}
-	#define BUF_LEN 32
-	int w = 0, h = 0, color_enabled = false;
+	for( i = 0; i < n; i++ ) {
+		// Entries must be new, valid code points so each keeps its index.
+		if( glyphIntern( brd->glyphs, getU32LE( in + 4 + i*4 ) ) != GLYPH_ASCII_END + (int)i ) {
+			errLog( "boardLoadFromFile(): %s: glyph table entry %u is invalid", filename, i );
+			return false;
+		}
+	}
+	return true;
+}
 
-	Cell work;
-	work.pattern = ' ';
-	work.fg = COLOR_WHITE;
-	work.bg = COLOR_BLACK;
-	work.bright = true;
-	work.blink = false;
+static Board * boardLoadFromBinary( const unsigned char * data, size_t size, char * filename ) {
+	uint32_t w, h;
+	unsigned int flags;
+	if( !checkBinary( data, size, filename, &w, &h, &flags ) ) {
+		return NULL;
+	}
+	size_t n_cells = (size_t)w * h;
 
-	char buf[BUF_LEN];
-	if( fgets( buf, BUF_LEN, f ) != NULL ) {
-		w = atoi( buf );
+	// Every cell is written below (blank runs of a sparse board are blank
+	// already), so skip boardInit()'s wipe.
+	Board * brd = boardAlloc( w, h, ( flags & BRD_FLAG_COLOR ) != 0 );
+	if( !brd ) {
+		errLog( "boardLoadFromFile(): boardAlloc() failed on %s", filename );
+		return NULL;
 	}
-	if( fgets( buf, BUF_LEN, f ) != NULL ) {
-		h = atoi( buf );
+
+	// The payload already holds Cell words: copy straight out of the mapping.
+	const unsigned char * in = data + BRD_HEADER_SIZE;
+	int x, y, len;
+	if( !( flags & BRD_FLAG_ROW_MAJOR ) ) {
+		// Early v2 files stored cells column-major.
+		for( x = 0; x < brd->w; x++ ) {
+			for( y = 0; y < brd->h; y++ ) {
+				boardPutCell( brd, getU32LE( in ), x, y );
+				in += 4;
+			}
+		}
 	}
-	if( fgets( buf, BUF_LEN, f ) != NULL ) {
-		color_enabled = atoi( buf );
+	else if( brd->layout == BOARD_LAYOUT_LINEAR ) {
+		cellsFromFile( brd->cells, in, n_cells );
+	}
+	else {
+		for( y = 0; y < brd->h; y++ ) {
+			for( x = 0; x < brd->w; x += len ) {
+				len = spanRun( brd, x );
+				// Leave blank runs of a sparse board unallocated.
+				if( brd->layout == BOARD_LAYOUT_SPARSE && sparseSkip( brd, x, y, getU32LE( in ) ) ) {
+					int i;
+					for( i = 1; i < len && getU32LE( in + i*4 ) == brd->empty_tile[0]; i++ );
+					if( i == len ) {
+						in += (size_t)len * 4;
+						continue;
+					}
+				}
+				Cell * dst = cellForWrite( brd, x, y );
+				if( !dst ) {
+					boardFree( brd );
+					return NULL;
+				}
+				cellsFromFile( dst, in, len );
+				in += (size_t)len * 4;
+			}
+		}
 	}
+	if( !glyphsFromFile( brd, data, flags, filename ) ) {
+		boardFree( brd );
+		return NULL;
+	}
+	return brd;
+}
 
-	if( w < 1 || h < 1 ) {
-		errLog( "boardLoadFromFile(): invalid dimensions (w%d h%d) on %s", w, h, filename ); 
+// Cursor over a text .brd held in memory. Each value sits on its own line.
+typedef struct TextScan_t {
+	const unsigned char * p;
+	const unsigned char * end;
+	int line;
+} TextScan;
+
+enum { SCAN_OK, SCAN_EOF, SCAN_BAD };
+
+// Parse one decimal integer line. Leading/trailing blanks and "\r\n" line
+// endings are accepted; anything else on the line is an error. Values are
+// clamped to INT_MAX so overlong numbers fail the range checks below.
+static int scanInt( TextScan * ts, long * out ) {
+	const unsigned char * p = ts->p;
+	const unsigned char * end = ts->end;
+	while( p < end && ( *p == ' ' || *p == '\t' ) ) {
+		p++;
+	}
+	if( p == end ) {
+		return SCAN_EOF;
+	}
+	bool neg = false;
+	if( *p == '-' ) {
+		neg = true;
+		p++;
+	}
+	if( p == end || *p < '0' || *p > '9' ) {
+		return SCAN_BAD;
+	}
+	long v = 0;
+	while( p < end && *p >= '0' && *p <= '9' ) {
+		if( v < INT_MAX ) {
+			v = v * 10 + ( *p - '0' );
+		}
+		p++;
+	}
+	while( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) ) {
+		p++;
+	}
+	if( p < end ) {
+		if( *p != '\n' ) {
+			return SCAN_BAD;
+		}
+		p++;
+	}
+	ts->p = p;
+	ts->line++;
+	*out = neg ? -v : v;
+	return SCAN_OK;
+}
+
+// Log why scanField() rejected a value.
+static bool scanFailed( TextScan * ts, int r, long lo, long hi, const char * what, long * out, char * filename ) {
+	if( r == SCAN_EOF ) {
+		errLog( "boardLoadFromFile(): %s is truncated at line %d (expected %s)", filename, ts->line + 1, what );
+		return false;
+	}
+	if( r == SCAN_BAD ) {
+		errLog( "boardLoadFromFile(): %s line %d: %s is not a number", filename, ts->line + 1, what );
+		return false;
+	}
+	errLog( "boardLoadFromFile(): %s line %d: %s %ld out of range [%ld, %ld]", filename, ts->line, what, *out, lo, hi );
+	return false;
+}
+
+// Read a value and check it against [lo, hi], logging where it went wrong.
+static inline bool scanField( TextScan * ts, long lo, long hi, const char * what, long * out, char * filename ) {
+	int r = scanInt( ts, out );
+	if( r == SCAN_OK && *out >= lo && *out <= hi ) {
+		return true;
+	}
+	return scanFailed( ts, r, lo, hi, what, out, filename );
+}
+
+#define IS_DIGIT(c) ( (unsigned)( (c) - '0' ) < 10 )
+
+/*  Fast path for one cell exactly as boardSaveToTextFile() writes it:
+    "pattern\nfg\nbg\nbright\nblink\n" with an ASCII pattern and
+    single-digit, in-range fields. Returns false (consuming nothing) for
+    anything else, and the caller falls back to scanField().             */
+static inline bool scanCellFast( TextScan * ts, Cell * out ) {
+	const unsigned char * p = ts->p;
+	if( ts->end - p < 12 ) {
+		return false;
+	}
+	if( !IS_DIGIT( p[0] ) ) {
+		return false;
+	}
+	unsigned pattern = p[0] - '0';
+	p++;
+	if( IS_DIGIT( *p ) ) {
+		pattern = pattern * 10 + ( *p++ - '0' );
+		if( IS_DIGIT( *p ) ) {
+			pattern = pattern * 10 + ( *p++ - '0' );
+		}
+	}
+	if( *p++ != '\n' || pattern >= GLYPH_ASCII_END ) {
+		return false;
+	}
+	unsigned fg = p[0] - '0', bg = p[2] - '0', bright = p[4] - '0', blink = p[6] - '0';
+	if( p[1] != '\n' || p[3] != '\n' || p[5] != '\n' || p[7] != '\n' ||
+		fg > 9 || bg > 9 || bright > 1 || blink > 1 ) {
+		return false;
+	}
+	ts->p = p + 8;
+	ts->line += 5;
+	*out = cellMake( pattern, fg, bg, bright, blink );
+	return true;
+}
+
+// Store c at x, y of a board being loaded. False if a sparse tile
+// couldn't be allocated.
+static bool storeCell( Board * brd, int x, int y, Cell c ) {
+	Cell * dst = cellForWrite( brd, x, y );
+	if( dst ) {
+		*dst = c;
+	}
+	return dst != NULL;
+}
+
+// Legacy text format: w, h, color_enabled, then five values per cell
+// (pattern, fg, bg, bright, blink), column by column. Patterns are code
+// points; those above ASCII are interned as they are met.
+static Board * boardLoadFromText( const unsigned char * data, size_t size, char * filename ) {
+	TextScan ts = { data, data + size, 0 };
+	long w, h, color_enabled;
+	if( !scanField( &ts, 1, INT_MAX, "width", &w, filename ) ||
+		!scanField( &ts, 1, INT_MAX, "height", &h, filename ) ||
+		!scanField( &ts, 0, 1, "color flag", &color_enabled, filename ) ) {
 		return NULL;
 	}
 
-	Board * brd = boardInit( w, h, color_enabled );
+	// Every cell takes at least ten bytes ("0\n" five times, less the final
+	// newline). Checking up front keeps a corrupt header from allocating a
+	// huge board.
+	uint64_t n_cells = (uint64_t)w * h;
+	size_t left = size - (size_t)( ts.p - data );
+	if( n_cells > ( left + 1 ) / 10 ) {
+		errLog( "boardLoadFromFile(): %s is truncated: a %ldx%ld board needs at least %llu bytes of cells, file has %zu",
+			filename, w, h, (unsigned long long)n_cells * 10 - 1, left );
+		return NULL;
+	}
+
+	Board * brd = boardAlloc( w, h, color_enabled );
 	if( !brd ) {
 		errLog( "boardLoadFromFile(): malloc failed on brd" );
-		goto cleanup;
+		return NULL;
 	}
 
-	brd->w = w;
-	brd->h = h;
-	brd->color_enabled = color_enabled;
-
-	int x, y;
+	static const char * names[5] = { "pattern", "fg", "bg", "bright", "blink" };
+	static const long max[5] = { GLYPH_MAX_CODE_POINT, PALETTE_SIZE - 1, PALETTE_SIZE - 1, 1, 1 };
+	long v[5];
+	long lost = 0;
+	int x, y, i;
 	for( x = 0; x < w; x++ ) {
 		for( y = 0; y < h; y++ ) {
-			work.pattern = ' ';
-			work.fg = COLOR_WHITE;
-			work.bg = COLOR_BLACK;
-			work.bright = true;
-			work.blink = false;
-
-			if( fgets( buf, BUF_LEN, f ) != NULL ) {
-				 work.pattern = atoi( buf );
-				 //errLog( buf );
-			}
-			if( fgets( buf, BUF_LEN, f ) != NULL ) {
-				 work.fg = atoi( buf );
-				 //errLog( buf );
+			Cell c;
+			if( scanCellFast( &ts, &c ) ) {
+				if( !sparseSkip( brd, x, y, c ) && !storeCell( brd, x, y, c ) ) {
+					boardFree( brd );
+					return NULL;
+				}
+				continue;
 			}
-			if( fgets( buf, BUF_LEN, f ) != NULL ) {
-				 work.bg = atoi( buf );
-				 //errLog( buf );
+			for( i = 0; i < 5; i++ ) {
+				if( !scanField( &ts, 0, max[i], names[i], &v[i], filename ) ) {
+					errLog( "boardLoadFromFile(): ...while reading cell (%d, %d) of %s", x, y, filename );
+					boardFree( brd );
+					return NULL;
+				}
 			}
-			if( fgets( buf, BUF_LEN, f ) != NULL ) {
-				 work.bright = atoi( buf );
-				 //errLog( buf );
+			int pattern = boardInternGlyph( brd, v[0] );
+			if( pattern == GLYPH_REPLACEMENT && v[0] != GLYPH_REPLACEMENT ) {
+				lost++;
 			}
-			if( fgets( buf, BUF_LEN, f ) != NULL ) {
-				 work.blink = atoi( buf );
-				 //errLog( buf );
+			c = cellMake( pattern, v[1], v[2], v[3], v[4] );
+			if( !sparseSkip( brd, x, y, c ) && !storeCell( brd, x, y, c ) ) {
+				boardFree( brd );
+				return NULL;
 			}
+		}
+	}
+	if( lost ) {
+		errLog( "boardLoadFromFile(): %s uses more than %d distinct glyphs; %ld cells shown as '%c'", filename, GLYPH_TABLE_SIZE, lost, GLYPH_REPLACEMENT );
+	}
+	return brd;
+}
 
-			boardPutCell( brd, work, x, y );
+// Load a board, binary or text, from a file already in memory. Binary v2
+// files are recognized by their magic number, and the other formats' files
+// are refused by theirs; anything else is handed to the legacy text parser.
+Board * boardLoadFromMemory( const unsigned char * data, size_t size, char * filename ) {
+	static const struct { const char * magic; const char * what; } others[] = {
+		{ ANIM_MAGIC, "an animation" },
+		{ LAYER_MAGIC, "a layer" },
+		{ PACK_MAGIC, "a pack" },
+	};
+	size_t i;
+	if( size >= BRD_MAGIC_LEN && memcmp( data, BRD_MAGIC, BRD_MAGIC_LEN ) == 0 ) {
+		return boardLoadFromBinary( data, size, filename );
+	}
+	for( i = 0; i < sizeof(others) / sizeof(others[0]); i++ ) {
+		if( size >= BRD_MAGIC_LEN && memcmp( data, others[i].magic, BRD_MAGIC_LEN ) == 0 ) {
+			errLog( "boardLoadFromFile(): %s is %s file, not a board", filename, others[i].what );
+			return NULL;
 		}
 	}
-	cleanup:
-	fclose( f );
+	return boardLoadFromText( data, size, filename );
+}
+
+Board * boardLoadFromFile( char * filename ) {
+	FileMap fm;
+	if( !fileMapOpen( &fm, filename ) ) {
+		errLog( "boardLoadFromFile(): Could not load %s", filename );
+		return NULL;
+	}
+
+	Board * brd = boardLoadFromMemory( fm.data, fm.size, filename );
+	fileMapClose( &fm );
 	return brd;
 }
 
+/*  A board whose cells are the payload of the binary .brd at data, inside
+    the mapping held by share: nothing is copied. The view is linear and
+    copy-on-write like a snapshot; its first write gives it a private array.
+    It holds a reference to share, so it stays valid after its owner (a
+    Pack) is closed. Payloads that cannot be used in place (column-major,
+    big-endian host, misaligned) are loaded into a normal board instead.  */
+Board * boardViewFromBinary( const unsigned char * data, size_t size, CellShare * share, char * filename ) {
+	uint32_t w, h;
+	unsigned int flags;
+	if( !checkBinary( data, size, filename, &w, &h, &flags ) ) {
+		return NULL;
+	}
+	const unsigned char * in = data + BRD_HEADER_SIZE;
+#ifdef BRD_HOST_IS_LE
+	bool in_place = ( flags & BRD_FLAG_ROW_MAJOR ) && (uintptr_t)in % sizeof(Cell) == 0;
+#else
+	bool in_place = false;
+#endif
+	if( !in_place ) {
+		return boardLoadFromBinary( data, size, filename );
+	}
+
+	Board * view = allocBlock( h, 0 );
+	if( !view ) {
+		errLog( "boardViewFromBinary(): malloc() failed on view" );
+		return NULL;
+	}
+	view->w = w;
+	view->h = h;
+	view->color_enabled = ( flags & BRD_FLAG_COLOR ) != 0;
+	view->layout = BOARD_LAYOUT_LINEAR;
+	view->n_alloc = (size_t)w * h;
+	view->cells = (Cell *)in;
+	view->dirty_y1 = h - 1;
+	boardClearDirty( view );
+	atomic_fetch_add( &share->refs, 1 );
+	view->share = share;
+	if( !glyphsFromFile( view, data, flags, filename ) ) {
+		boardFree( view );
+		return NULL;
+	}
+	return view;
+}
+
 bool boardCopySection( Board * target, Board * dest, int tx, int ty, int tw, int th, int dx, int dy ) {
 	if( !target || !dest ) {
 		errLog( "boardCopySection(): Supplied NULL pointer(s).");
@@ -261,26 +1594,32 @@ bool boardCopySection( Board * target, Board * dest, int tx, int ty, int tw, int
 		errLog( "boardCopySection(): Supplied 0 or negative number for target w/h.");
 		return false;
 	}
-
-	int x, y;
-
-	for( x = tx; x < tx + tw; x++ ) {
-		for( y = ty; y < ty + th; y++ ) {
-			boardPutCell( dest, boardGetCell( target, x, y ), dx + (x-tx), dy + (y-ty) );
-		}
-	}
+	return boardBlit( target, tx, ty, tw, th, dest, dx, dy );
 }
 
 Board * boardMakeFromSelection( Board * target, int tx, int ty, int tw, int th ) {
-	Board * dest = boardInit( tw, th, target->color_enabled );
+	Board * dest = boardAlloc( tw, th, target->color_enabled );
 	if( !dest ) {
-		errLog( "boardMakeFromSelection(): boardInit() failed. Return NULL." );
+		errLog( "boardMakeFromSelection(): boardAlloc() failed. Return NULL." );
 		goto cleanup;
 	}
-
-	boardCopySection( target, dest, tx, ty, tw, th, 0, 0 );
+	boardFillFromSelection( target, dest, tx, ty );
 
 	cleanup:
 	return dest;
 }
 
+/*  Write every cell of dest, fresh from boardAlloc() or boardReshape(),
+    with the dest-sized selection of target at tx, ty. Only a selection
+    reaching past target's edges needs blanking first.                   */
+void boardFillFromSelection( Board * target, Board * dest, int tx, int ty ) {
+	Rect r = { tx, ty, dest->w, dest->h };
+	if( !boardClipRect( target, &r ) || r.w != dest->w || r.h != dest->h ) {
+		boardWipe( dest, ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	}
+	// Share the glyph table, so cells copy across as they are.
+	glyphTableRelease( dest->glyphs );
+	dest->glyphs = glyphTableRetain( target->glyphs );
+	boardCopySection( target, dest, tx, ty, dest->w, dest->h, 0, 0 );
+}
+
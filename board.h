@@ -1,11 +1,16 @@
 #ifndef BOARD_H
 #define BOARD_H
 	
+#include <stdint.h>
+#include <stdatomic.h>
+
 #include "curses.h"
 
 #include "error_handler.h"
 #include "curses_wrapper.h"
 #include "draw.h"
+#include "file_map.h"
+#include "glyph.h"
 
 
 /*typedef struct Stringl_t {
@@ -18,13 +23,80 @@ typedef struct Coord_t {
 	int y;
 } Coord;
 
-typedef struct Cell_t {
-	int pattern;
-	int fg;
-	int bg;
-	int bright;
-	int blink;
-} Cell;
+typedef struct Rect_t {
+	int x;
+	int y;
+	int w;
+	int h;
+} Rect;
+
+// A cell is packed into one 32-bit word:
+//   bits  0-7   pattern: a glyph index, ASCII below 128, else an entry
+//               in the board's glyph table (see glyph.h)
+//   bits  8-15  foreground color (index into the 256-color palette,
+//   bits 16-23  background color  see palette.h)
+//   bit  24     bright foreground
+//   bit  25     blink
+// Unused bits are always zero, so two cells can be compared as integers.
+// Use the cell*() accessors rather than poking at the bits directly.
+typedef uint32_t Cell;
+
+#define CELL_PATTERN_SHIFT 0
+#define CELL_FG_SHIFT 8
+#define CELL_BG_SHIFT 16
+#define CELL_BYTE_MASK 0xffu
+#define CELL_BRIGHT_BIT ( 1u << 24 )
+#define CELL_BLINK_BIT ( 1u << 25 )
+
+static inline Cell cellMake( int pattern, int fg, int bg, int bright, int blink ) {
+	return ( (Cell)( pattern & CELL_BYTE_MASK ) << CELL_PATTERN_SHIFT )
+		| ( (Cell)( fg & CELL_BYTE_MASK ) << CELL_FG_SHIFT )
+		| ( (Cell)( bg & CELL_BYTE_MASK ) << CELL_BG_SHIFT )
+		| ( bright ? CELL_BRIGHT_BIT : 0 )
+		| ( blink ? CELL_BLINK_BIT : 0 );
+}
+
+static inline int cellPattern( Cell c ) { return ( c >> CELL_PATTERN_SHIFT ) & CELL_BYTE_MASK; }
+static inline int cellFg( Cell c ) { return ( c >> CELL_FG_SHIFT ) & CELL_BYTE_MASK; }
+static inline int cellBg( Cell c ) { return ( c >> CELL_BG_SHIFT ) & CELL_BYTE_MASK; }
+static inline bool cellBright( Cell c ) { return ( c & CELL_BRIGHT_BIT ) != 0; }
+static inline bool cellBlink( Cell c ) { return ( c & CELL_BLINK_BIT ) != 0; }
+
+static inline Cell cellSetPattern( Cell c, int pattern ) {
+	return ( c & ~( CELL_BYTE_MASK << CELL_PATTERN_SHIFT ) ) | ( (Cell)( pattern & CELL_BYTE_MASK ) << CELL_PATTERN_SHIFT );
+}
+static inline Cell cellSetFg( Cell c, int fg ) {
+	return ( c & ~( CELL_BYTE_MASK << CELL_FG_SHIFT ) ) | ( (Cell)( fg & CELL_BYTE_MASK ) << CELL_FG_SHIFT );
+}
+static inline Cell cellSetBg( Cell c, int bg ) {
+	return ( c & ~( CELL_BYTE_MASK << CELL_BG_SHIFT ) ) | ( (Cell)( bg & CELL_BYTE_MASK ) << CELL_BG_SHIFT );
+}
+static inline Cell cellSetBright( Cell c, bool bright ) {
+	return bright ? ( c | CELL_BRIGHT_BIT ) : ( c & ~CELL_BRIGHT_BIT );
+}
+static inline Cell cellSetBlink( Cell c, bool blink ) {
+	return blink ? ( c | CELL_BLINK_BIT ) : ( c & ~CELL_BLINK_BIT );
+}
+
+// Cell storage layouts. Linear is plain row-major. Tiled stores the board
+// as 16x16 row-major tiles, themselves laid out row-major, so that very wide
+// boards keep vertically adjacent cells within a few cache lines.
+#define BOARD_LAYOUT_LINEAR 0
+#define BOARD_LAYOUT_TILED 1
+// Sparse uses the same tiles, but allocates each one on its first write.
+// Until then a tile points at the board's shared, read-only empty tile, so
+// memory follows the content rather than the board size.
+#define BOARD_LAYOUT_SPARSE 2
+
+#define BOARD_TILE_SHIFT 4
+#define BOARD_TILE_SIZE ( 1 << BOARD_TILE_SHIFT )
+#define BOARD_TILE_MASK ( BOARD_TILE_SIZE - 1 )
+#define BOARD_TILE_CELLS ( BOARD_TILE_SIZE * BOARD_TILE_SIZE )
+
+// boardInit() switches to the tiled layout at this width, and to the
+// sparse layout at this many cells.
+#define BOARD_TILED_MIN_W 1024
+#define BOARD_SPARSE_MIN_CELLS ( 4096 * 4096 )
 
 typedef struct Board_t {
 	int w;
@@ -32,25 +104,172 @@ typedef struct Board_t {
 	Cell * cells;
 	bool color_enabled;
 
-	char * filename;
+	int layout;
+	int tiles_w;        // Tiled and sparse layouts: tiles per row.
+	size_t n_alloc;     // Number of Cells allocated (>= w*h when tiled, 0 when sparse).
+
+	// Sparse layout only (cells is NULL): a directory of tile pointers,
+	// tiles_w per row, and the empty tile unwritten entries point at.
+	Cell ** tiles;
+	Cell * empty_tile;
+	size_t n_tiles;     // Tiles allocated, not counting empty_tile.
+
+	// Per-row dirty spans for incremental drawing. Row y needs repainting
+	// from dirty_x0[y] to dirty_x1[y] inclusive; x0 > x1 means clean.
+	// dirty_y0/dirty_y1 bound the dirty rows (y0 > y1 when nothing is dirty).
+	int * dirty_x0;
+	int * dirty_x1;
+	int dirty_y0;
+	int dirty_y1;
+
+	// Undo journal recording edits to this board, or NULL.
+	struct UndoJournal_t * journal;
+
+	// Non-NULL while the cell array is shared with a snapshot. The first
+	// write after boardSnapshot() gives the board its own copy.
+	struct CellShare_t * share;
+	// Bumped on every write, so callers can tell whether a board changed.
+	// Generations only compare within one board: id tells boards apart,
+	// unique for the life of the process (a snapshot keeps its board's).
+	unsigned long generation;
+	uint64_t id;
+
+	// Code points for patterns >= GLYPH_ASCII_END, or NULL while the board
+	// is pure ASCII. Shared with snapshots and boards copied from this one.
+	GlyphTable * glyphs;
+
+	// The board, its dirty spans and (linear and tiled layouts) its cells
+	// are one allocation, sized for cap_h rows and cap_cells cells, so a
+	// pooled board can be reshaped for anything that fits (boardReshape()).
+	// cells_inline is cleared once the board moves to a copy of its cells.
+	bool cells_inline;
+	int cap_h;
+	size_t cap_cells;
+	// A share whose snapshots still read the cells inside this allocation
+	// after the board moved to its own copy: boardFree() leaves freeing the
+	// allocation to the last of them.
+	struct CellShare_t * pin;
 } Board;
 
+// Reference count for a cell array shared between a board and snapshots.
+// Whoever drops the last reference frees the cells. When map holds a file
+// (map.data != NULL) the cells live inside that mapping instead, e.g. a
+// board view into a pack: they are never freed or written, and the last
+// reference closes the map. When block is set the cells live inside that
+// board's own allocation, and the last reference frees the whole block.
+typedef struct CellShare_t {
+	atomic_int refs;
+	FileMap map;
+	Board * block;
+} CellShare;
+
+bool boardUnshare( Board * board );
+CellShare * cellShareFromMap( FileMap * fm );
+void cellShareRelease( CellShare * share );
+
+// Call before writing to board->cells. Returns false, with the board left
+// unchanged, if it couldn't get cells of its own: drop the write.
+static inline bool boardTouch( Board * board ) {
+	board->generation++;
+	return !board->share || boardUnshare( board );
+}
+
+// Index into board->cells for an in-bounds x, y (linear and tiled layouts).
+static inline size_t boardCellIndex( const Board * board, int x, int y ) {
+	if( board->layout == BOARD_LAYOUT_TILED ) {
+		size_t tile = (size_t)( y >> BOARD_TILE_SHIFT ) * board->tiles_w + ( x >> BOARD_TILE_SHIFT );
+		return ( tile * BOARD_TILE_CELLS ) + ( ( y & BOARD_TILE_MASK ) << BOARD_TILE_SHIFT ) + ( x & BOARD_TILE_MASK );
+	}
+	return (size_t)y * board->w + x;
+}
+
+// Pointer to the cell at an in-bounds x, y, for reading. Any layout.
+static inline const Cell * boardCellPtr( const Board * board, int x, int y ) {
+	if( board->layout == BOARD_LAYOUT_SPARSE ) {
+		const Cell * tile = board->tiles[ (size_t)( y >> BOARD_TILE_SHIFT ) * board->tiles_w + ( x >> BOARD_TILE_SHIFT ) ];
+		return tile + ( ( y & BOARD_TILE_MASK ) << BOARD_TILE_SHIFT ) + ( x & BOARD_TILE_MASK );
+	}
+	return &board->cells[ boardCellIndex( board, x, y ) ];
+}
+
 #define CELL_OUT_OF_BOUNDS 0
 #define TEST_FILE "test_file.sav"
 
+// .brd v2 (binary) file layout. All integers are little-endian.
+//   0  char[4]  magic "BRDB"
+//   4  u16      version (BRD_VERSION)
+//   6  u16      flags (BRD_FLAG_*)
+//   8  u32      width
+//  12  u32      height
+//  16  u32[w*h] Cell words, row-major when BRD_FLAG_ROW_MAJOR is set
+//               (all files written now), column-major otherwise
+//  ..  u32      glyph count n, when BRD_FLAG_GLYPHS is set
+//  ..  u32[n]   code points of patterns 128.. in order
+// The header is a multiple of 4 bytes so the payload stays word-aligned
+// when the file is mapped into memory, and the payload words use the same
+// bit layout as Cell, so on little-endian hosts loading a linear board is
+// one memcpy().
+#define BRD_MAGIC "BRDB"
+#define BRD_MAGIC_LEN 4
+#define BRD_VERSION 2
+#define BRD_HEADER_SIZE 16
+#define BRD_FLAG_COLOR 0x0001
+#define BRD_FLAG_ROW_MAJOR 0x0002
+#define BRD_FLAG_GLYPHS 0x0004
+
+// Defined when Cell words are already in file byte order.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BRD_HOST_IS_LE 1
+#endif
+
 bool outOfBounds( int x, int y, int w, int h );
 Cell boardGetCell( Board * board, int x, int y );
 void boardPutCell( Board * board, Cell new_cell, int x, int y );
+const Cell * boardSpan( Board * board, int x, int y, int * len );
+Cell * boardSpanWritable( Board * board, int x, int y, int * len );
 void boardWipe( Board * board, int wipe_pattern, int fg, int bg, int bright, int blink );
+bool boardClipRect( const Board * board, Rect * r );
+void boardFillSpan( Board * board, int x, int y, int len, Cell c );
+void boardFillRect( Board * board, int x, int y, int w, int h, Cell c );
+void boardDrawLine( Board * board, int x0, int y0, int x1, int y1, Cell c );
+void boardDrawBox( Board * board, int x, int y, int w, int h, Cell c );
+bool boardBlit( Board * src, int sx, int sy, int w, int h, Board * dst, int dx, int dy );
+bool boardBlitKeyed( Board * src, int sx, int sy, int w, int h, Board * dst, int dx, int dy, Cell key );
 Board * boardInit( int w, int h, bool color );
+Board * boardInitLayout( int w, int h, bool color, int layout );
+Board * boardAlloc( int w, int h, bool color );
+bool boardReshape( Board * board, int w, int h, bool color );
 void boardFree( Board * board );
+Board * boardSnapshot( Board * board );
+size_t boardMemoryUsage( const Board * board );
+void boardMarkDirty( Board * board, int x, int y, int w, int h );
+void boardMarkAllDirty( Board * board );
+void boardClearDirty( Board * board );
 void boardDraw( Board * board, Coord offset, bool draw_border );
+void boardDrawViewport( Board * board, const Viewport * vp, bool draw_border );
+void boardDrawBorder( const Viewport * vp );
+void boardDrawDirty( Board * board, const Viewport * vp );
+bool boardRowToChtypes( Board * board, int y, int x0, int n, chtype * out );
+#if DRAW_WIDE
+void boardRowToCchars( Board * board, int y, int x0, int n, cchar_t * out );
+#endif
 bool sameCells( Cell a, Cell b );
-void floodFill( Board * board, Cell first, Cell second, int x, int y );
+int boardInternGlyph( Board * board, uint32_t cp );
+uint32_t boardGlyphCodePoint( const Board * board, int index );
+uint64_t boardChecksum( Board * board );
+int floodFill( Board * board, Cell first, Cell second, int x, int y, int connectivity, Rect * changed );
 bool boardSaveToFile( Board * brd, char * filename );
+bool boardSaveToTextFile( Board * brd, char * filename );
 Board * boardLoadFromFile( char * filename );
+Board * boardLoadFromMemory( const unsigned char * data, size_t size, char * filename );
+Board * boardViewFromBinary( const unsigned char * data, size_t size, CellShare * share, char * filename );
+bool boardWriteBinary( Board * brd, FILE * f );
+uint64_t boardBinarySize( const Board * brd );
+FILE * saveOpen( const char * filename, char * tmp_name, size_t tmp_len, const char * mode );
+bool saveClose( FILE * f, const char * tmp_name, const char * filename, bool ok );
 
 Board * boardMakeFromSelection( Board * target, int tx, int ty, int tw, int th );
+void boardFillFromSelection( Board * target, Board * dest, int tx, int ty );
 bool boardCopySection( Board * target, Board * dest, int tx, int ty, int tw, int th, int dx, int dy );
 
 #endif
@@ -0,0 +1,129 @@
+#include "board_baked.h"
+
+BakedBoard * boardBake( Board * board ) {
+	BakedBoard * baked = malloc( sizeof(BakedBoard) );
+	if( !baked ) {
+		errLog( "boardBake(): malloc() failed on baked board" );
+		return NULL;
+	}
+	baked->w = board->w;
+	baked->h = board->h;
+	baked->cells = malloc( (size_t)board->w * board->h * sizeof(chtype) );
+	if( !baked->cells ) {
+		errLog( "boardBake(): malloc() failed on %dx%d cells", board->w, board->h );
+		free( baked );
+		return NULL;
+	}
+#if DRAW_WIDE
+	baked->wide = calloc( board->h, sizeof(cchar_t *) );
+	if( !baked->wide ) {
+		errLog( "boardBake(): malloc() failed on %d wide rows", board->h );
+		bakedFree( baked );
+		return NULL;
+	}
+#endif
+	int y;
+	for( y = 0; y < board->h; y++ ) {
+		bool wide = boardRowToChtypes( board, y, 0, board->w, baked->cells + (size_t)y * board->w );
+#if DRAW_WIDE
+		if( wide ) {
+			baked->wide[y] = malloc( (size_t)board->w * sizeof(cchar_t) );
+			if( !baked->wide[y] ) {
+				errLog( "boardBake(): malloc() failed on wide row %d", y );
+				bakedFree( baked );
+				return NULL;
+			}
+			boardRowToCchars( board, y, 0, board->w, baked->wide[y] );
+		}
+#else
+		(void)wide;
+#endif
+	}
+	return baked;
+}
+
+// Load a .brd file straight into baked form.
+BakedBoard * bakedLoad( char * filename ) {
+	Board * board = boardLoadFromFile( filename );
+	if( !board ) {
+		return NULL;
+	}
+	BakedBoard * baked = boardBake( board );
+	boardFree( board );
+	return baked;
+}
+
+void bakedFree( BakedBoard * baked ) {
+	if( baked ) {
+#if DRAW_WIDE
+		int y;
+		for( y = 0; baked->wide && y < baked->h; y++ ) {
+			free( baked->wide[y] );
+		}
+		free( baked->wide );
+#endif
+		free( baked->cells );
+		free( baked );
+	}
+}
+
+void bakedBlit( const BakedBoard * baked, WINDOW * win, int wy, int wx ) {
+	bakedBlitRect( baked, 0, 0, baked->w, baked->h, win, wy, wx );
+}
+
+/*  Draw the w x h rect at sx, sy of the baked board into win with its
+    top-left corner at wy, wx. Clipped to both the board and the window.
+    Nothing is refreshed; call wrefresh() / wnoutrefresh() as usual.     */
+void bakedBlitRect( const BakedBoard * baked, int sx, int sy, int w, int h, WINDOW * win, int wy, int wx ) {
+	int max_y, max_x;
+	getmaxyx( win, max_y, max_x );
+
+	// Clip against the board, then the window, moving the other corner
+	// along with each.
+	if( sx < 0 ) {
+		w += sx;
+		wx -= sx;
+		sx = 0;
+	}
+	if( sy < 0 ) {
+		h += sy;
+		wy -= sy;
+		sy = 0;
+	}
+	if( wx < 0 ) {
+		w += wx;
+		sx -= wx;
+		wx = 0;
+	}
+	if( wy < 0 ) {
+		h += wy;
+		sy -= wy;
+		wy = 0;
+	}
+	if( w > baked->w - sx ) {
+		w = baked->w - sx;
+	}
+	if( h > baked->h - sy ) {
+		h = baked->h - sy;
+	}
+	if( w > max_x - wx ) {
+		w = max_x - wx;
+	}
+	if( h > max_y - wy ) {
+		h = max_y - wy;
+	}
+	if( w < 1 ) {
+		return;     // A negative count would mean "to the end of the line".
+	}
+
+	int y;
+	for( y = 0; y < h; y++ ) {
+#if DRAW_WIDE
+		if( baked->wide[sy + y] ) {
+			mvwadd_wchnstr( win, wy + y, wx, baked->wide[sy + y] + sx, w );
+			continue;
+		}
+#endif
+		mvwaddchnstr( win, wy + y, wx, baked->cells + (size_t)( sy + y ) * baked->w + sx, w );
+	}
+}
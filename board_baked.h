@@ -0,0 +1,35 @@
+#ifndef BOARD_BAKED_H
+#define BOARD_BAKED_H
+
+#include "curses.h"
+
+#include "board.h"
+
+/*  A board pre-converted for display: one chtype per cell, row-major, with
+    the color pair and bold/blink already resolved through colPair(). Baking
+    needs curses (and its colors) started; afterwards drawing it, or any
+    part of it, into a WINDOW is one mvwaddchnstr() per row, no per-cell
+    work. Bake again if the board or the color pairs change; pairs from
+    the pair cache can be redefined once other colors are drawn.
+
+    chtypes are narrow, so in plain builds interned glyphs are baked as
+    their ACS look-alikes, and colors whose pair is above 255 fall back to
+    the terminal default. Wide builds also bake the rows that need either
+    as cchar_t strips, drawn with mvwadd_wchnstr() instead.              */
+typedef struct BakedBoard_t {
+	int w;
+	int h;
+	chtype * cells;
+#if DRAW_WIDE
+	cchar_t ** wide;    // Per row: its cchar_t strip, or NULL if chtypes do.
+#endif
+} BakedBoard;
+
+BakedBoard * boardBake( Board * board );
+BakedBoard * bakedLoad( char * filename );
+void bakedFree( BakedBoard * baked );
+
+void bakedBlit( const BakedBoard * baked, WINDOW * win, int wy, int wx );
+void bakedBlitRect( const BakedBoard * baked, int sx, int sy, int w, int h, WINDOW * win, int wy, int wx );
+
+#endif // BOARD_BAKED_H
@@ -0,0 +1,232 @@
+// Wide builds need wcwidth(), which <wchar.h> only declares for X/Open.
+#if defined(NCURSES_WIDECHAR) && NCURSES_WIDECHAR
+#define _XOPEN_SOURCE 700
+#endif
+#include <wchar.h>
+
+#include "board.h"
+#include "pair_cache.h"
+#include "profile.h"
+
+// Curses rendering for boards. Kept apart from board.c so the board core
+// can be linked into tools that don't use curses.
+
+// Cells are converted to chtypes in chunks of this size, then emitted with
+// one mvaddchnstr() per chunk.
+#define DRAW_CHUNK 256
+
+// Nearest ACS character for a code point, for narrow curses. Box drawing
+// collapses to single lines, shades and blocks to the checkerboard and
+// block, and anything without a look-alike to GLYPH_REPLACEMENT.
+static chtype glyphToAcs( uint32_t cp ) {
+	switch( cp ) {
+	case 0x2500: case 0x2501: case 0x2550: return ACS_HLINE;
+	case 0x2502: case 0x2503: case 0x2551: return ACS_VLINE;
+	case 0x250c: case 0x2552: case 0x2553: case 0x2554: return ACS_ULCORNER;
+	case 0x2510: case 0x2555: case 0x2556: case 0x2557: return ACS_URCORNER;
+	case 0x2514: case 0x2558: case 0x2559: case 0x255a: return ACS_LLCORNER;
+	case 0x2518: case 0x255b: case 0x255c: case 0x255d: return ACS_LRCORNER;
+	case 0x251c: case 0x255e: case 0x255f: case 0x2560: return ACS_LTEE;
+	case 0x2524: case 0x2561: case 0x2562: case 0x2563: return ACS_RTEE;
+	case 0x252c: case 0x2564: case 0x2565: case 0x2566: return ACS_TTEE;
+	case 0x2534: case 0x2567: case 0x2568: case 0x2569: return ACS_BTEE;
+	case 0x253c: case 0x256a: case 0x256b: case 0x256c: return ACS_PLUS;
+	case 0x2591: case 0x2592: case 0x2593: return ACS_CKBOARD;
+	case 0x2588: case 0x2580: case 0x2584: case 0x258c: case 0x2590: case 0x25a0: return ACS_BLOCK;
+	case 0x2022: case 0x2219: case 0x00b7: return ACS_BULLET;
+	case 0x25c6: case 0x2666: return ACS_DIAMOND;
+	case 0x00b0: return ACS_DEGREE;
+	case 0x00b1: return ACS_PLMINUS;
+	case 0x2264: return ACS_LEQUAL;
+	case 0x2265: return ACS_GEQUAL;
+	case 0x2260: return ACS_NEQUAL;
+	case 0x03c0: return ACS_PI;
+	case 0x00a3: return ACS_STERLING;
+	case 0x2190: case 0x25c4: return ACS_LARROW;
+	case 0x2192: case 0x25ba: return ACS_RARROW;
+	case 0x2191: case 0x25b2: return ACS_UARROW;
+	case 0x2193: case 0x25bc: return ACS_DARROW;
+	}
+	return GLYPH_REPLACEMENT;
+}
+
+/*  Convert board cells x0..x0+n-1 of row y to chtypes in out. Attributes
+    are only recomputed where they change, so a run of same-colored cells
+    costs one colPair() lookup. Interned glyphs get their ACS look-alike.
+    Returns true if the row has glyphs, or colors whose pair a chtype can't
+    hold, so wide builds know to redraw it with boardRowToCchars().      */
+bool boardRowToChtypes( Board * board, int y, int x0, int n, chtype * out ) {
+	Cell attr_key = CELL_OUT_OF_BOUNDS;
+	chtype attr = 0;
+	bool have_attr = false;
+	bool wide = false;
+	int x, i, len;
+
+	for( x = x0; x < x0 + n; x += len ) {
+		const Cell * c = boardSpan( board, x, y, &len );
+		if( len > x0 + n - x ) {
+			len = x0 + n - x;
+		}
+		for( i = 0; i < len; i++ ) {
+			Cell current = c[i];
+			Cell key = cellSetPattern( current, 0 );
+			if( !have_attr || key != attr_key ) {
+				int pair = colPair( cellFg( current ), cellBg( current ) );
+				attr = colorPairAttr( pair, cellBright( current ), cellBlink( current ) );
+				attr_key = key;
+				have_attr = true;
+				wide |= pair > PAIR_CHTYPE_MAX;
+			}
+			int pattern = cellPattern( current );
+			if( pattern >= GLYPH_ASCII_END ) {
+				*out++ = glyphToAcs( glyphCodePoint( board->glyphs, pattern ) ) | attr;
+				wide = true;
+			}
+			else {
+				*out++ = (chtype)pattern | attr;
+			}
+		}
+	}
+	return wide;
+}
+
+#if DRAW_WIDE
+// As boardRowToChtypes(), as wide characters. Code points that are not one
+// column wide in the current locale are shown as GLYPH_REPLACEMENT, so the
+// row keeps its shape.
+void boardRowToCchars( Board * board, int y, int x0, int n, cchar_t * out ) {
+	Cell attr_key = CELL_OUT_OF_BOUNDS;
+	attr_t attr = 0;
+	int pair = 0;
+	bool have_attr = false;
+	int x, i, len;
+
+	for( x = x0; x < x0 + n; x += len ) {
+		const Cell * c = boardSpan( board, x, y, &len );
+		if( len > x0 + n - x ) {
+			len = x0 + n - x;
+		}
+		for( i = 0; i < len; i++ ) {
+			Cell current = c[i];
+			Cell key = cellSetPattern( current, 0 );
+			if( !have_attr || key != attr_key ) {
+				pair = colPair( cellFg( current ), cellBg( current ) );
+				attr = colorPairAttr( 0, cellBright( current ), cellBlink( current ) );
+				attr_key = key;
+				have_attr = true;
+			}
+			wchar_t wc[2] = { glyphCodePoint( board->glyphs, cellPattern( current ) ), L'\0' };
+			if( wc[0] >= GLYPH_ASCII_END && wcwidth( wc[0] ) != 1 ) {
+				wc[0] = GLYPH_REPLACEMENT;
+			}
+#if PAIR_EXTENDED
+			setcchar( out++, wc, attr, 0, &pair );
+#else
+			setcchar( out++, wc, attr, pair, NULL );
+#endif
+		}
+	}
+}
+#endif
+
+// Paint board cells x0..x1 of row y at their position in the viewport.
+// Rows without interned glyphs or extended pairs take the chtype path even
+// in wide builds.
+static void drawRowSpan( Board * board, const Viewport * vp, int y, int x0, int x1 ) {
+	chtype buf[DRAW_CHUNK];
+	int sy = vp->y + ( y - vp->cam_y );
+	int x, n;
+
+	for( x = x0; x <= x1; x += n ) {
+		n = x1 - x + 1;
+		if( n > DRAW_CHUNK ) {
+			n = DRAW_CHUNK;
+		}
+#if DRAW_WIDE
+		if( boardRowToChtypes( board, y, x, n, buf ) ) {
+			cchar_t wbuf[DRAW_CHUNK];
+			boardRowToCchars( board, y, x, n, wbuf );
+			mvadd_wchnstr( sy, vp->x + ( x - vp->cam_x ), wbuf, n );
+		}
+		else {
+			mvaddchnstr( sy, vp->x + ( x - vp->cam_x ), buf, n );
+		}
+#else
+		boardRowToChtypes( board, y, x, n, buf );
+		mvaddchnstr( sy, vp->x + ( x - vp->cam_x ), buf, n );
+#endif
+		profCount( PROF_CURSES_CALLS, 1 );
+		profCount( PROF_CELLS_DRAWN, n );
+	}
+}
+
+// Draw the whole board with its top-left corner at offset, culled to the
+// part that fits on the terminal.
+void boardDraw( Board * board, Coord offset, bool draw_border ) {
+	Viewport vp = {0};
+	viewportFit( &vp, offset.x, offset.y, 0, 0, board->w, board->h );
+	boardDrawViewport( board, &vp, draw_border );
+}
+
+// pair_cache.evictions when the viewport was last painted in full. Any
+// eviction since may have recolored cells that aren't dirty.
+static unsigned long painted_evictions;
+
+// Draw the visible part of the board. Everything is repainted, so the
+// dirty spans are cleared, including those outside the camera.
+void boardDrawViewport( Board * board, const Viewport * vp, bool draw_border ) {
+	int y;
+	for( y = vp->cam_y; y < vp->cam_y + vp->h; y++ ) {
+		drawRowSpan( board, vp, y, vp->cam_x, vp->cam_x + vp->w - 1 );
+	}
+	boardClearDirty( board );
+	painted_evictions = pair_cache.evictions;
+	if( draw_border ) {
+		boardDrawBorder( vp );
+	}
+}
+
+void boardDrawBorder( const Viewport * vp ) {
+	int x, y;
+	colorSet( COLOR_BLACK, COLOR_BLACK, 1, 0 );
+	for( x = 0; x < vp->w; x++ ) {
+		//top
+		mvaddch( vp->y - 1,     x + vp->x, '-' );
+		//bottom
+		mvaddch( vp->y + vp->h, x + vp->x, '-' );
+	}
+	for( y = 0; y < vp->h; y++ ) {
+		//left
+		mvaddch( y + vp->y, vp->x - 1,     '|' );
+		//right
+		mvaddch( y + vp->y, vp->x + vp->w, '|' );
+	}
+	//corners
+	mvaddch( vp->y - 1,     vp->x - 1, '+' );
+	mvaddch( vp->y + vp->h, vp->x - 1, '+' );
+	mvaddch( vp->y + vp->h, vp->x + vp->w, '+' );
+	mvaddch( vp->y - 1,     vp->x + vp->w, '+' );
+	profCount( PROF_CURSES_CALLS, 2 * vp->w + 2 * vp->h + 5 );
+}
+
+// Repaint only the visible cells touched since the last draw, then mark
+// everything clean. Off-screen changes are picked up when the camera moves,
+// since that repaints the whole viewport. So does a color pair eviction,
+// which can recolor cells that are still on screen.
+void boardDrawDirty( Board * board, const Viewport * vp ) {
+	int y0 = board->dirty_y0 > vp->cam_y ? board->dirty_y0 : vp->cam_y;
+	int y1 = board->dirty_y1 < vp->cam_y + vp->h - 1 ? board->dirty_y1 : vp->cam_y + vp->h - 1;
+	int y;
+	for( y = y0; y <= y1; y++ ) {
+		int x0 = board->dirty_x0[y] > vp->cam_x ? board->dirty_x0[y] : vp->cam_x;
+		int x1 = board->dirty_x1[y] < vp->cam_x + vp->w - 1 ? board->dirty_x1[y] : vp->cam_x + vp->w - 1;
+		if( x0 <= x1 ) {
+			drawRowSpan( board, vp, y, x0, x1 );
+		}
+	}
+	if( pair_cache.evictions != painted_evictions ) {
+		boardDrawViewport( board, vp, false );
+		return;
+	}
+	boardClearDirty( board );
+}
@@ -0,0 +1,138 @@
+#include "board_export.h"
+#include "palette.h"
+
+// Curses color numbers in CSS, normal then bright.
+static const char * html_colors[2][N_COLORS] = {
+	{ "#000000", "#aa0000", "#00aa00", "#aa5500", "#0000aa", "#aa00aa", "#00aaaa", "#aaaaaa" },
+	{ "#555555", "#ff5555", "#55ff55", "#ffff55", "#5555ff", "#ff55ff", "#55ffff", "#ffffff" },
+};
+
+int exportFormatFromName( const char * name ) {
+	if( strcmp( name, "text" ) == 0 ) {
+		return EXPORT_TEXT;
+	}
+	if( strcmp( name, "ansi" ) == 0 ) {
+		return EXPORT_ANSI;
+	}
+	if( strcmp( name, "html" ) == 0 ) {
+		return EXPORT_HTML;
+	}
+	return -1;
+}
+
+const char * exportFormatExtension( int format ) {
+	switch( format ) {
+		case EXPORT_ANSI: return ".ans";
+		case EXPORT_HTML: return ".html";
+		default: return ".txt";
+	}
+}
+
+// Code point to write for a cell: its interned glyph, or a blank for ASCII
+// control characters.
+static uint32_t exportGlyph( const Board * board, Cell c ) {
+	uint32_t g = boardGlyphCodePoint( board, cellPattern( c ) );
+	return ( g < 32 || g == 127 ) ? ' ' : g;
+}
+
+// SGR parameter for a palette color: the classic "3n"/"4n" for the first
+// eight, "38;5;n"/"48;5;n" for the rest. base is 3 or 4.
+static void ansiColor( char * out, size_t len, int base, int color ) {
+	if( color < N_COLORS ) {
+		snprintf( out, len, "%d%d", base, color );
+	}
+	else {
+		snprintf( out, len, "%d8;5;%d", base, color );
+	}
+}
+
+// CSS color for a palette color. The classic eight use the brighter shade
+// when bright is set, as curses' A_BOLD shows them.
+static void htmlColor( char * out, size_t len, int color, bool bright ) {
+	if( color < N_COLORS ) {
+		snprintf( out, len, "%s", html_colors[ bright ? 1 : 0 ][color] );
+		return;
+	}
+	int r, g, b;
+	paletteRgb( color, &r, &g, &b );
+	snprintf( out, len, "#%02x%02x%02x", r, g, b );
+}
+
+// Emit the escape/markup that switches output to attribute key (a cell with
+// its glyph masked off). Only called at the start of each color run.
+static void exportAttr( FILE * f, int format, Cell key, bool first ) {
+	char fg[16], bg[16];
+	if( format == EXPORT_ANSI ) {
+		ansiColor( fg, sizeof(fg), 3, cellFg( key ) );
+		ansiColor( bg, sizeof(bg), 4, cellBg( key ) );
+		fprintf( f, "\x1b[0;%s%s%s;%sm", cellBright( key ) ? "1;" : "", cellBlink( key ) ? "5;" : "", fg, bg );
+	}
+	else if( format == EXPORT_HTML ) {
+		if( !first ) {
+			fputs( "</span>", f );
+		}
+		htmlColor( fg, sizeof(fg), cellFg( key ), cellBright( key ) );
+		htmlColor( bg, sizeof(bg), cellBg( key ), false );
+		fprintf( f, "<span style=\"color:%s;background:%s%s\">", fg, bg,
+			cellBlink( key ) ? ";text-decoration:blink" : "" );
+	}
+}
+
+// Text and ANSI output is UTF-8; HTML uses character references above
+// ASCII, so the page needs no charset.
+static void exportChar( FILE * f, int format, uint32_t g ) {
+	if( format == EXPORT_HTML ) {
+		switch( g ) {
+			case '<': fputs( "&lt;", f ); return;
+			case '>': fputs( "&gt;", f ); return;
+			case '&': fputs( "&amp;", f ); return;
+		}
+		if( g >= GLYPH_ASCII_END ) {
+			fprintf( f, "&#x%x;", (unsigned)g );
+			return;
+		}
+	}
+	if( g < GLYPH_ASCII_END ) {
+		putc( g, f );
+		return;
+	}
+	char utf8[4];
+	fwrite( utf8, 1, glyphToUtf8( g, utf8 ), f );
+}
+
+/*  Stream a board to f, one row at a time, so memory use doesn't depend on
+    the board size. Returns false on a write error.                        */
+bool boardExport( Board * board, FILE * f, int format ) {
+	int x, y, i, len;
+
+	if( format == EXPORT_HTML ) {
+		fputs( "<pre style=\"font-family:monospace;line-height:1\">\n", f );
+	}
+	for( y = 0; y < board->h; y++ ) {
+		Cell key = 0;
+		bool first = true;
+		for( x = 0; x < board->w; x += len ) {
+			const Cell * c = boardSpan( board, x, y, &len );
+			for( i = 0; i < len; i++ ) {
+				Cell k = cellSetPattern( c[i], 0 );
+				if( format != EXPORT_TEXT && ( first || k != key ) ) {
+					exportAttr( f, format, k, first );
+					key = k;
+					first = false;
+				}
+				exportChar( f, format, exportGlyph( board, c[i] ) );
+			}
+		}
+		if( format == EXPORT_ANSI ) {
+			fputs( "\x1b[0m", f );
+		}
+		else if( format == EXPORT_HTML && !first ) {
+			fputs( "</span>", f );
+		}
+		putc( '\n', f );
+	}
+	if( format == EXPORT_HTML ) {
+		fputs( "</pre>\n", f );
+	}
+	return !ferror( f );
+}
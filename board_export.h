@@ -0,0 +1,17 @@
+#ifndef BOARD_EXPORT_H
+#define BOARD_EXPORT_H
+
+#include <stdio.h>
+
+#include "board.h"
+
+// Output formats for boardExport().
+#define EXPORT_TEXT 0   // Glyphs only, one line per row.
+#define EXPORT_ANSI 1   // Glyphs with ANSI SGR color escapes.
+#define EXPORT_HTML 2   // A <pre> block with one <span> per color run.
+
+int exportFormatFromName( const char * name );
+const char * exportFormatExtension( int format );
+bool boardExport( Board * board, FILE * f, int format );
+
+#endif // BOARD_EXPORT_H
@@ -0,0 +1,38 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+
+// Little-endian loads and stores for the .brd, animation, layer and pack
+// file formats. (Not endian.h, which would shadow the system header.)
+
+static inline void putU16LE( unsigned char * p, unsigned int v ) {
+	p[0] = v & 0xff;
+	p[1] = ( v >> 8 ) & 0xff;
+}
+
+static inline void putU32LE( unsigned char * p, uint32_t v ) {
+	p[0] = v & 0xff;
+	p[1] = ( v >> 8 ) & 0xff;
+	p[2] = ( v >> 16 ) & 0xff;
+	p[3] = ( v >> 24 ) & 0xff;
+}
+
+static inline void putU64LE( unsigned char * p, uint64_t v ) {
+	putU32LE( p, (uint32_t)v );
+	putU32LE( p + 4, (uint32_t)( v >> 32 ) );
+}
+
+static inline unsigned int getU16LE( const unsigned char * p ) {
+	return p[0] | ( p[1] << 8 );
+}
+
+static inline uint32_t getU32LE( const unsigned char * p ) {
+	return (uint32_t)p[0] | ( (uint32_t)p[1] << 8 ) | ( (uint32_t)p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static inline uint64_t getU64LE( const unsigned char * p ) {
+	return getU32LE( p ) | ( (uint64_t)getU32LE( p + 4 ) << 32 );
+}
+
+#endif // BYTE_ORDER_H
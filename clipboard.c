@@ -0,0 +1,102 @@
+#include <string.h>
+
+#include "clipboard.h"
+#include "profile.h"
+#include "error_handler.h"
+
+void clipInit( Clipboard * clip ) {
+	memset( clip, 0, sizeof(Clipboard) );
+}
+
+void clipFree( Clipboard * clip ) {
+	int i;
+	for( i = 0; i < clip->n; i++ ) {
+		boardFree( clip->slots[i] );
+	}
+	for( i = 0; i < clip->n_pool; i++ ) {
+		boardFree( clip->pool[i] );
+	}
+	clipInit( clip );
+}
+
+/*  A w x h board with unwritten cells: the smallest spare that can be
+    reshaped to fit, else a new one.                                      */
+static Board * poolGet( Clipboard * clip, int w, int h, bool color ) {
+	int i, best = -1;
+	for( i = 0; i < clip->n_pool; i++ ) {
+		Board * b = clip->pool[i];
+		if( h <= b->cap_h && ( best < 0 || b->cap_cells < clip->pool[best]->cap_cells )
+			&& (uint64_t)w * h <= b->cap_cells ) {
+			best = i;
+		}
+	}
+	if( best >= 0 && boardReshape( clip->pool[best], w, h, color ) ) {
+		Board * b = clip->pool[best];
+		clip->pool[best] = clip->pool[--clip->n_pool];
+		profCount( PROF_CLIP_REUSES, 1 );
+		return b;
+	}
+	profCount( PROF_CLIP_ALLOCS, 1 );
+	return boardAlloc( w, h, color );
+}
+
+// Keep board as a spare. When the pool is full the smallest board goes.
+static void poolPut( Clipboard * clip, Board * board ) {
+	if( !board->cells_inline || board->share ) {
+		boardFree( board );
+		return;
+	}
+	if( clip->n_pool < CLIP_POOL_SIZE ) {
+		clip->pool[clip->n_pool++] = board;
+		return;
+	}
+	int i, smallest = 0;
+	for( i = 1; i < clip->n_pool; i++ ) {
+		if( clip->pool[i]->cap_cells < clip->pool[smallest]->cap_cells ) {
+			smallest = i;
+		}
+	}
+	if( clip->pool[smallest]->cap_cells < board->cap_cells ) {
+		Board * gone = clip->pool[smallest];
+		clip->pool[smallest] = board;
+		board = gone;
+	}
+	boardFree( board );
+}
+
+/*  Copy the w x h selection of src at x, y into a new history entry, which
+    becomes the current one. Returns it, or NULL (history unchanged) for an
+    empty selection or a failed allocation.                              */
+Board * clipCopy( Clipboard * clip, Board * src, int x, int y, int w, int h ) {
+	if( w < 1 || h < 1 ) {
+		errLog( "clipCopy(): empty selection %dx%d", w, h );
+		return NULL;
+	}
+	Board * copy = poolGet( clip, w, h, src->color_enabled );
+	if( !copy ) {
+		errLog( "clipCopy(): no board for a %dx%d copy", w, h );
+		return NULL;
+	}
+	boardFillFromSelection( src, copy, x, y );
+	if( clip->n == CLIP_SLOTS ) {
+		poolPut( clip, clip->slots[--clip->n] );
+	}
+	memmove( clip->slots + 1, clip->slots, clip->n * sizeof(Board *) );
+	clip->slots[0] = copy;
+	clip->n++;
+	clip->current = 0;
+	return copy;
+}
+
+// The entry to paste, or NULL while nothing has been copied.
+Board * clipCurrent( Clipboard * clip ) {
+	return clip->n ? clip->slots[clip->current] : NULL;
+}
+
+// Move step entries back in the history (older for positive steps),
+// wrapping around at either end.
+void clipSelect( Clipboard * clip, int step ) {
+	if( clip->n ) {
+		clip->current = ( ( clip->current + step ) % clip->n + clip->n ) % clip->n;
+	}
+}
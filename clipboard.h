@@ -0,0 +1,32 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include <stdbool.h>
+
+#include "board.h"
+
+/*  Clipboard history: the last CLIP_SLOTS copies, newest first, any one of
+    which can be pasted. A copy that falls off the end of the history is
+    kept as a spare in the pool, up to CLIP_POOL_SIZE of them, and a new
+    copy is made in the smallest spare whose allocation can hold it
+    (boardReshape()). Copying and pasting the same large region over and
+    over thus settles on a fixed set of boards instead of a malloc() and
+    free() per copy.                                                     */
+#define CLIP_SLOTS 8
+#define CLIP_POOL_SIZE 4
+
+typedef struct Clipboard_t {
+	Board * slots[CLIP_SLOTS];      // Newest first.
+	int n;
+	int current;                    // The slot clipCurrent() returns.
+	Board * pool[CLIP_POOL_SIZE];   // Spare boards, contents stale.
+	int n_pool;
+} Clipboard;
+
+void clipInit( Clipboard * clip );
+void clipFree( Clipboard * clip );
+Board * clipCopy( Clipboard * clip, Board * src, int x, int y, int w, int h );
+Board * clipCurrent( Clipboard * clip );
+void clipSelect( Clipboard * clip, int step );
+
+#endif // CLIPBOARD_H
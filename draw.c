@@ -1,37 +1,119 @@
-#include "draw.h"
-
-// Wrap curses draw-character function to include attributes.
-void drawGlyph( int glyph, int x, int y, int fg, int bg, int bright_fg, int bright_bg ) {
-
-    colorSet( fg, bg, bright_fg, bright_bg );
-
-    mvaddch( y, x, glyph);
-
-    return;
-}
-
-int colPair(int fg, int bg) {
-    // if out of bounds, report as an error and use the monochrome pair (0).
-    if(fg < 0 || fg > N_COLORS || bg < 0 || bg > N_COLORS ) {
-        errLog("colPair(): Was asked to return a pair that is out of bounds. Requested: fg %d, bg %d. Returning monochrome (pair 0) instead.", fg, bg );
-        return 0;
-    }
-    return col_map[fg][bg];
-}
-
-void colorSet( int fg, int bg, int fg_intensity, int bg_blink ) {
-    if( fg_intensity ) {
-        attron( A_BOLD );
-    }
-    else {
-        attroff( A_BOLD );
-    }
-
-    if( bg_blink ) {
-        attron( A_BLINK );
-    }
-    else {
-        attroff( A_BLINK );
-    }
-    attron( COLOR_PAIR( colPair( fg, bg ) ) );
-}
+#include "draw.h"
+#include "pair_cache.h"
+
+// Wrap curses draw-character function to include attributes.
+void drawGlyph( int glyph, int x, int y, int fg, int bg, int bright_fg, int bright_bg ) {
+
+    colorSet( fg, bg, bright_fg, bright_bg );
+
+    mvaddch( y, x, glyph);
+
+    return;
+}
+
+// Pair for any two palette colors: the fixed pairs for the classic eight,
+// the pair cache for the rest.
+int colPair(int fg, int bg) {
+    // if out of bounds, report as an error and use the monochrome pair (0).
+    if(fg < 0 || fg >= PALETTE_SIZE || bg < 0 || bg >= PALETTE_SIZE ) {
+        errLogLimited( LOG_WARN, "colPair(): Was asked to return a pair that is out of bounds. Requested: fg %d, bg %d. Returning monochrome (pair 0) instead.", fg, bg );
+        return 0;
+    }
+    if( fg < N_COLORS && bg < N_COLORS ) {
+        return col_map[fg][bg];
+    }
+    return pairCacheGet( &pair_cache, fg, bg );
+}
+
+// Attribute word for a pair from colPair(), ready to OR into a chtype.
+// Pairs a chtype can't hold are left out; draw those cells as cchar_t.
+chtype colorPairAttr( int pair, int fg_intensity, int bg_blink ) {
+    chtype attr = pair <= PAIR_CHTYPE_MAX ? COLOR_PAIR( pair ) : 0;
+    if( fg_intensity ) {
+        attr |= A_BOLD;
+    }
+    if( bg_blink ) {
+        attr |= A_BLINK;
+    }
+    return attr;
+}
+
+// Full attribute word for a color combo, ready to OR into a chtype.
+chtype colorAttr( int fg, int bg, int fg_intensity, int bg_blink ) {
+    return colorPairAttr( colPair( fg, bg ), fg_intensity, bg_blink );
+}
+
+// Replaces the current attributes outright, so a previous color pair or
+// bold/blink state never leaks into the next draw call.
+void colorSet( int fg, int bg, int fg_intensity, int bg_blink ) {
+    attrset( colorAttr( fg, bg, fg_intensity, bg_blink ) );
+}
+
+/*  Size the viewport to the current terminal (LINES x COLS). It starts at
+    x, y and takes whatever is left of the screen after reserving reserve_w
+    columns on the right and reserve_h rows at the bottom, but never more
+    than the map. The camera keeps its position, clamped to the new size.   */
+void viewportFit( Viewport * vp, int x, int y, int reserve_w, int reserve_h, int map_w, int map_h ) {
+    vp->x = x;
+    vp->y = y;
+    vp->w = COLS - x - reserve_w;
+    vp->h = LINES - y - reserve_h;
+    if( vp->w > map_w ) {
+        vp->w = map_w;
+    }
+    if( vp->h > map_h ) {
+        vp->h = map_h;
+    }
+    if( vp->w < 0 ) {
+        vp->w = 0;
+    }
+    if( vp->h < 0 ) {
+        vp->h = 0;
+    }
+    if( vp->cam_x > map_w - vp->w ) {
+        vp->cam_x = map_w - vp->w;
+    }
+    if( vp->cam_y > map_h - vp->h ) {
+        vp->cam_y = map_h - vp->h;
+    }
+}
+
+// Scroll the camera just enough to keep map point x, y visible.
+// Returns true if the camera moved (and the viewport needs a full repaint).
+bool viewportFollow( Viewport * vp, int x, int y, int map_w, int map_h ) {
+    int cam_x = vp->cam_x;
+    int cam_y = vp->cam_y;
+
+    if( x < cam_x ) {
+        cam_x = x;
+    }
+    else if( x > cam_x + vp->w - 1 ) {
+        cam_x = x - vp->w + 1;
+    }
+    if( y < cam_y ) {
+        cam_y = y;
+    }
+    else if( y > cam_y + vp->h - 1 ) {
+        cam_y = y - vp->h + 1;
+    }
+
+    if( cam_x > map_w - vp->w ) {
+        cam_x = map_w - vp->w;
+    }
+    if( cam_y > map_h - vp->h ) {
+        cam_y = map_h - vp->h;
+    }
+    if( cam_x < 0 ) {
+        cam_x = 0;
+    }
+    if( cam_y < 0 ) {
+        cam_y = 0;
+    }
+
+    if( cam_x == vp->cam_x && cam_y == vp->cam_y ) {
+        return false;
+    }
+    vp->cam_x = cam_x;
+    vp->cam_y = cam_y;
+    return true;
+}
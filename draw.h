@@ -1,32 +1,46 @@
-#ifndef DRAW_H
-#define DRAW_H
-
-#include "curses.h"
-#include "curses_wrapper.h"
-
-#include "error_handler.h"
-
-#define RANGE_TYPE_SQUARE 1
-#define RANGE_TYPE_CIRCLE 2
-
-// The viewport is the window into the gameworld / map.
-// If the map is larger than the viewport, scroll to follow the player or another point of interest.
-// Viewport does not include the status bar or message log.
-int VIEWPORT_W;
-int VIEWPORT_H;
-
-// Drawing offsets from 0,0 in the top-left corner.
-int VIEWPORT_X;
-int VIEWPORT_Y;
-
-// Size of the console window. Traditionally this is typically 80x24 or 80x25 (MS-DOS).
-// This could be made variable.
-#define SCREEN_W 80
-#define SCREEN_H 25
-
-void drawGlyph( int glyph, int x, int y, int fg, int bg, int bright_fg, int bright_bg );
-int colPair( int fg, int bg );
-void colorSet( int fg, int bg, int fg_intensity, int bg_blink );
-
-#endif // DRAW_H
-
+#ifndef DRAW_H
+#define DRAW_H
+
+#include "curses.h"
+#include "curses_wrapper.h"
+
+#include "error_handler.h"
+
+// Wide-character curses (ncursesw, or PDCurses built wide): glyphs above
+// ASCII are drawn as themselves rather than their ACS look-alikes. Build
+// with -DNCURSES_WIDECHAR=1 and link -lncursesw to get it.
+#if ( defined(NCURSES_WIDECHAR) && NCURSES_WIDECHAR ) || defined(PDC_WIDE)
+#define DRAW_WIDE 1
+#else
+#define DRAW_WIDE 0
+#endif
+
+#define RANGE_TYPE_SQUARE 1
+#define RANGE_TYPE_CIRCLE 2
+
+// The viewport is the window into the gameworld / map.
+// If the map is larger than the viewport, scroll to follow the player or another point of interest.
+// Viewport does not include the status bar or message log.
+typedef struct Viewport_t {
+    // Drawing offsets from 0,0 in the top-left corner of the screen.
+    int x;
+    int y;
+    // Size on screen, in cells. Never larger than the map.
+    int w;
+    int h;
+    // Map coordinate shown in the viewport's top-left corner.
+    int cam_x;
+    int cam_y;
+} Viewport;
+
+void viewportFit( Viewport * vp, int x, int y, int reserve_w, int reserve_h, int map_w, int map_h );
+bool viewportFollow( Viewport * vp, int x, int y, int map_w, int map_h );
+
+void drawGlyph( int glyph, int x, int y, int fg, int bg, int bright_fg, int bright_bg );
+int colPair( int fg, int bg );
+chtype colorPairAttr( int pair, int fg_intensity, int bg_blink );
+chtype colorAttr( int fg, int bg, int fg_intensity, int bg_blink );
+void colorSet( int fg, int bg, int fg_intensity, int bg_blink );
+
+#endif // DRAW_H
+
@@ -1,116 +1,303 @@
-#include "error_handler.h"
-
-void errorHandlerInit( ErrorHandler * e, int redirect_to_stderr ) {
-    e->redirect_to_stderr = redirect_to_stderr;
-
-    if( e->redirect_to_stderr ) {
-        fprintf( stderr, "Redirecting debug logs to stderr." );
-        e->f_err_log = stderr;
-    }
-    else {
-        e->f_err_log = fopen("./debug.log", "a");
-
-        if( !e->f_err_log ) {
-            e->initialized = 0;
-
-            printf( "\nWARNING: errorHandlerInit(): Cannot open debug.txt for appending. Press Enter.\n");
-
-            getchar();
-        }
-    }
-    e->initialized = 1;
-
-    return;
-}
-
-void errorHandlerShutdown( ErrorHandler * e ) {
-    if( (!e->redirect_to_stderr) && (e->f_err_log) )  {
-        fclose(e->f_err_log);
-    }
-
-    return;
-}
-
-
-/*  Main error-logging function. Tag message with date and time, and append a
-    newline to the end. The *fprintf functions are wrapped in another function
-    because va_start / va_end do not like to be nested.                         */
-
-void errLog( char * formatted_string, ... ) {
-
-    if( !error_handler.initialized ) {
-        // Can't write anything if no valid FILE handle.
-        return;
-    }
-
-    va_list args;
-    va_start( args, formatted_string );
-
-    errLogVaList( formatted_string, args );
-
-    va_end(args);
-
-    return;
-}
-
-void errQuit( char * formatted_string, ...  ) {
-
-	// Only try to write out if the error handler was initialized by the base program.
-	if( error_handler.initialized ) {
-	    va_list args;
-	    va_start( args, formatted_string );
-
-	    errLogVaList( formatted_string, args );
-	    errLogVaList( "errQuit(): Bad program termination.", args );
-    	
-		va_end(args);
-
-    	// Try to close f_err_log so that messages are flushed prior to crashing.
-	    errorHandlerShutdown( &error_handler );
-	}
-    
-	// Try to shut down Curses gracefully.
-    // Commented out as this causes a segfault.
-    //endwin();
-
-    // Try to inform of the crash via stdio.
-    // (Can't do this while still in Curses mode)
-    //printf( "errQuit() caused a program termination. Attempted to flush debug.txt which may have messages related to the crash.\n\nPress Enter to quit\n");
-    //getchar();
-
-
-    // If you ever do malloc counting, you could try freeing allocated pointers here.
-
-    // Force close.
-
-    exit(1);
-
-    return;
-}
-
-/* See the C FAQ for more info about wrapping va_args:
-   http://c-faq.com/varargs/handoff.html               */
-void errLogVaList( char * formatted_string, va_list args ) {
-
-    time_t t;
-    time(&t);
-
-    /* Use a temporary buffer to clip off the newline generated by ctime().
-       ctime() should return a string of roughly 25 characters, but may return
-       additional chars if the year is greater than 9999. Or so I hear.        */
-    #define ERRLOG_TEMP_BUFFER_LEN 64
-    char temp_buffer[ERRLOG_TEMP_BUFFER_LEN];
-    snprintf( temp_buffer, ERRLOG_TEMP_BUFFER_LEN, ctime(&t) );
-    temp_buffer[strlen(temp_buffer) - 1] = 0x0;
-
-    // 1/3 Print time
-    fprintf( error_handler.f_err_log, "%s: ", temp_buffer );
-
-    // 2/3 Print the actual error message
-    vfprintf( error_handler.f_err_log, formatted_string, args );
-
-    // 3/3 Print newline
-    fprintf( error_handler.f_err_log, "\n" );
-
-    return;
-}
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "error_handler.h"
+
+/*  Messages are formatted by the caller into a slot of a fixed ring buffer
+    and written out by a background thread, so logging never waits on file
+    I/O. Slots are claimed lock-free (each carries a sequence number, as in
+    a bounded MPMC queue), so the UI thread, autosave and tool worker
+    threads can all log. If the ring is full the message is dropped and
+    counted; the writer reports the count.                               */
+
+#define ERRLOG_RING_SLOTS 1024      // Must be a power of two.
+#define ERRLOG_MSG_LEN 240
+
+typedef struct LogSlot_t {
+    atomic_size_t seq;
+    time_t t;
+    int level;
+    char msg[ERRLOG_MSG_LEN];
+} LogSlot;
+
+static LogSlot log_ring[ERRLOG_RING_SLOTS];
+static atomic_size_t log_head;      // Next position producers claim.
+static size_t log_tail;             // Next position the writer reads.
+static atomic_ulong log_dropped;
+static atomic_bool log_stop;
+
+// How long the writer sleeps when the ring is empty.
+#define ERRLOG_WRITER_IDLE_NS ( 10 * 1000 * 1000 )
+
+static const char * level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+// Write one message in the usual "<ctime>: message" form, with the level
+// tag for anything that isn't an error. One fprintf(), so concurrent
+// synchronous writers don't interleave mid-line.
+static void writeMessage( FILE * f, time_t t, int level, const char * msg ) {
+    /* Use a temporary buffer to clip off the newline generated by ctime().
+       ctime() should return a string of roughly 25 characters, but may return
+       additional chars if the year is greater than 9999. Or so I hear.        */
+    #define ERRLOG_TEMP_BUFFER_LEN 64
+    char temp_buffer[ERRLOG_TEMP_BUFFER_LEN];
+    if( !ctime_r( &t, temp_buffer ) ) {
+        temp_buffer[0] = 0x0;
+    }
+    size_t len = strlen( temp_buffer );
+    if( len > 0 && temp_buffer[len - 1] == '\n' ) {
+        temp_buffer[len - 1] = 0x0;
+    }
+
+    if( level == LOG_ERROR ) {
+        fprintf( f, "%s: %s\n", temp_buffer, msg );
+    }
+    else {
+        fprintf( f, "%s: [%s] %s\n", temp_buffer, level_names[level], msg );
+    }
+}
+
+// Writer side: write out everything queued so far. Returns the count.
+static int drainRing( ErrorHandler * e ) {
+    int n = 0;
+    for( ;; ) {
+        LogSlot * s = &log_ring[log_tail & ( ERRLOG_RING_SLOTS - 1 )];
+        size_t seq = atomic_load_explicit( &s->seq, memory_order_acquire );
+        if( seq != log_tail + 1 ) {
+            break;
+        }
+        writeMessage( e->f_err_log, s->t, s->level, s->msg );
+        atomic_store_explicit( &s->seq, log_tail + ERRLOG_RING_SLOTS, memory_order_release );
+        log_tail++;
+        n++;
+    }
+    unsigned long dropped = atomic_exchange( &log_dropped, 0 );
+    if( dropped ) {
+        char msg[64];
+        snprintf( msg, sizeof(msg), "Log ring full; %lu messages dropped.", dropped );
+        writeMessage( e->f_err_log, time( NULL ), LOG_WARN, msg );
+        n++;
+    }
+    if( n > 0 ) {
+        fflush( e->f_err_log );
+    }
+    return n;
+}
+
+static void * writerThread( void * arg ) {
+    ErrorHandler * e = arg;
+    struct timespec idle = { 0, ERRLOG_WRITER_IDLE_NS };
+    for( ;; ) {
+        // Read the stop flag before draining so nothing queued before
+        // shutdown is left behind.
+        bool stop = atomic_load( &log_stop );
+        if( drainRing( e ) == 0 ) {
+            if( stop ) {
+                break;
+            }
+            nanosleep( &idle, NULL );
+        }
+    }
+    return NULL;
+}
+
+void errorHandlerInit( ErrorHandler * e, int redirect_to_stderr ) {
+    e->redirect_to_stderr = redirect_to_stderr;
+    e->min_level = LOG_DEBUG;
+    e->writer_running = false;
+
+    if( e->redirect_to_stderr ) {
+        fprintf( stderr, "Redirecting debug logs to stderr." );
+        e->f_err_log = stderr;
+    }
+    else {
+        e->f_err_log = fopen("./debug.log", "a");
+
+        if( !e->f_err_log ) {
+            e->initialized = 0;
+
+            printf( "\nWARNING: errorHandlerInit(): Cannot open debug.txt for appending. Press Enter.\n");
+
+            getchar();
+            return;
+        }
+    }
+
+    size_t i;
+    for( i = 0; i < ERRLOG_RING_SLOTS; i++ ) {
+        atomic_init( &log_ring[i].seq, i );
+    }
+    atomic_init( &log_head, 0 );
+    log_tail = 0;
+    atomic_init( &log_dropped, 0 );
+    atomic_init( &log_stop, false );
+
+    // If the writer can't start, errLog() falls back to writing directly.
+    if( pthread_create( &e->writer, NULL, writerThread, e ) == 0 ) {
+        e->writer_running = true;
+    }
+
+    e->initialized = 1;
+
+    return;
+}
+
+void errorHandlerShutdown( ErrorHandler * e ) {
+    if( e->writer_running ) {
+        atomic_store( &log_stop, true );
+        pthread_join( e->writer, NULL );
+        e->writer_running = false;
+    }
+    if( (!e->redirect_to_stderr) && (e->f_err_log) )  {
+        fclose(e->f_err_log);
+        e->f_err_log = NULL;
+    }
+    e->initialized = 0;
+
+    return;
+}
+
+
+/*  Main error-logging function. Tag message with date and time, and append a
+    newline to the end. The *fprintf functions are wrapped in another function
+    because va_start / va_end do not like to be nested.                         */
+
+#ifndef ERRLOG_DISABLE
+
+void errLog( char * formatted_string, ... ) {
+
+    if( !error_handler.initialized ) {
+        // Can't write anything if no valid FILE handle.
+        return;
+    }
+
+    va_list args;
+    va_start( args, formatted_string );
+
+    errLogVaList( LOG_ERROR, formatted_string, args );
+
+    va_end(args);
+
+    return;
+}
+
+void errLogLevel( int level, char * formatted_string, ... ) {
+
+    if( !error_handler.initialized || level < error_handler.min_level ) {
+        return;
+    }
+
+    va_list args;
+    va_start( args, formatted_string );
+
+    errLogVaList( level, formatted_string, args );
+
+    va_end(args);
+
+    return;
+}
+
+#endif // ERRLOG_DISABLE
+
+void errQuit( char * formatted_string, ...  ) {
+
+	// Only try to write out if the error handler was initialized by the base program.
+	if( error_handler.initialized ) {
+	    va_list args;
+	    va_start( args, formatted_string );
+
+	    errLogVaList( LOG_ERROR, formatted_string, args );
+	    va_end(args);
+
+	    va_start( args, formatted_string );
+	    errLogVaList( LOG_ERROR, "errQuit(): Bad program termination.", args );
+		va_end(args);
+
+    	// Stop the writer and close f_err_log so that messages are flushed prior to crashing.
+	    errorHandlerShutdown( &error_handler );
+	}
+    
+	// Try to shut down Curses gracefully.
+    // Commented out as this causes a segfault.
+    //endwin();
+
+    // Try to inform of the crash via stdio.
+    // (Can't do this while still in Curses mode)
+    //printf( "errQuit() caused a program termination. Attempted to flush debug.txt which may have messages related to the crash.\n\nPress Enter to quit\n");
+    //getchar();
+
+
+    // If you ever do malloc counting, you could try freeing allocated pointers here.
+
+    // Force close.
+
+    exit(1);
+
+    return;
+}
+
+/*  Returns -1 if this call site has used up its messages for the current
+    second, otherwise the number of messages suppressed since the last one
+    that got through. Lock-free, as call sites are reached from worker
+    threads as well as the UI thread.                                      */
+int errRateLimit( ErrRateLimit * rl ) {
+    uint_fast64_t window = (uint32_t)time( NULL );
+    uint_fast64_t state = atomic_load_explicit( &rl->state, memory_order_relaxed );
+    for( ;; ) {
+        if( ( state >> 32 ) != window ) {
+            if( atomic_compare_exchange_weak_explicit( &rl->state, &state, ( window << 32 ) | 1,
+                    memory_order_relaxed, memory_order_relaxed ) ) {
+                return atomic_exchange_explicit( &rl->suppressed, 0, memory_order_relaxed );
+            }
+        }
+        else if( ( state & 0xffffffff ) >= ERRLOG_RATE_LIMIT ) {
+            atomic_fetch_add_explicit( &rl->suppressed, 1, memory_order_relaxed );
+            return -1;
+        }
+        else if( atomic_compare_exchange_weak_explicit( &rl->state, &state, state + 1,
+                    memory_order_relaxed, memory_order_relaxed ) ) {
+            return 0;
+        }
+    }
+}
+
+/* See the C FAQ for more info about wrapping va_args:
+   http://c-faq.com/varargs/handoff.html               */
+void errLogVaList( int level, char * formatted_string, va_list args ) {
+
+    if( !error_handler.writer_running ) {
+        char msg[ERRLOG_MSG_LEN];
+        vsnprintf( msg, sizeof(msg), formatted_string, args );
+        writeMessage( error_handler.f_err_log, time( NULL ), level, msg );
+        return;
+    }
+
+    // Claim a slot. A slot is free for position pos when its sequence
+    // number equals pos; the writer bumps it by a full lap once read.
+    size_t pos = atomic_load_explicit( &log_head, memory_order_relaxed );
+    LogSlot * s;
+    for( ;; ) {
+        s = &log_ring[pos & ( ERRLOG_RING_SLOTS - 1 )];
+        size_t seq = atomic_load_explicit( &s->seq, memory_order_acquire );
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if( diff == 0 ) {
+            if( atomic_compare_exchange_weak_explicit( &log_head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) ) {
+                break;
+            }
+        }
+        else if( diff < 0 ) {
+            // Full: the writer hasn't caught up. Drop rather than block.
+            atomic_fetch_add( &log_dropped, 1 );
+            return;
+        }
+        else {
+            pos = atomic_load_explicit( &log_head, memory_order_relaxed );
+        }
+    }
+
+    s->t = time( NULL );
+    s->level = level;
+    vsnprintf( s->msg, ERRLOG_MSG_LEN, formatted_string, args );
+    atomic_store_explicit( &s->seq, pos + 1, memory_order_release );
+
+    return;
+}
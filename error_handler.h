@@ -1,40 +1,103 @@
-#ifndef ERROR_HANDLER_H
-#define ERROR_HANDLER_H
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdarg.h>
-#include <time.h>
-
-#include "curses.h"
-
-// -- Variables
-
-typedef struct error_handler_t {
-    int initialized;
-    int redirect_to_stderr;
-    FILE *f_err_log;
-} ErrorHandler;
-
-ErrorHandler error_handler;
-
-
-// -- Functions
-
-// Startup / shutdown
-// TODO include an option to *not* log debug messages at all.
-void errorHandlerInit( ErrorHandler * e, int redirect_to_stderr );
-void errorHandlerShutdown( ErrorHandler * e );
-
-// Log an error message.
-void errLog( char * formatted_string, ... );
-
-// Log an error and crash the application.
-void errQuit( char * formatted_string, ... );
-
-// Variadic function wrapper for logging formatted messages.
-// This should only be used by errLog() and errQuit().
-void errLogVaList( char * formatted_string, va_list args );
-
-#endif // ERROR_HANDLER_H
+#ifndef ERROR_HANDLER_H
+#define ERROR_HANDLER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "curses.h"
+
+// -- Log levels
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+// Messages from one errLogLimited() call site allowed per second.
+#define ERRLOG_RATE_LIMIT 5
+
+// -- Variables
+
+typedef struct error_handler_t {
+    int initialized;
+    int redirect_to_stderr;
+    FILE *f_err_log;
+
+    int min_level;          // Messages below this level are dropped before formatting.
+
+    // Background writer. When it isn't running, messages are written
+    // synchronously instead.
+    bool writer_running;
+    pthread_t writer;
+} ErrorHandler;
+
+ErrorHandler error_handler;
+
+// Per-call-site state for errLogLimited(), shared by every thread that
+// reaches the call site. state holds the current second in its top 32 bits
+// and the messages let through in it below, so both change in one step.
+typedef struct ErrRateLimit_t {
+    atomic_uint_fast64_t state;
+    atomic_int suppressed;
+} ErrRateLimit;
+
+
+// -- Functions
+
+// Startup / shutdown
+void errorHandlerInit( ErrorHandler * e, int redirect_to_stderr );
+void errorHandlerShutdown( ErrorHandler * e );
+
+// Log an error and crash the application.
+void errQuit( char * formatted_string, ... );
+
+#ifndef ERRLOG_DISABLE
+
+// Log an error message.
+void errLog( char * formatted_string, ... );
+
+// Log a message at one of the LOG_* levels.
+void errLogLevel( int level, char * formatted_string, ... );
+
+// Log at most ERRLOG_RATE_LIMIT messages per second from this call site,
+// noting how many were skipped. Safe to use in per-cell / per-frame code.
+#define errLogLimited( level, ... ) do { \
+    static ErrRateLimit errlog_rl_; \
+    int errlog_skipped_ = errRateLimit( &errlog_rl_ ); \
+    if( errlog_skipped_ > 0 ) { \
+        errLogLevel( level, "(%d similar messages suppressed)", errlog_skipped_ ); \
+    } \
+    if( errlog_skipped_ >= 0 ) { \
+        errLogLevel( level, __VA_ARGS__ ); \
+    } \
+} while( 0 )
+
+#else
+
+// Build with -DERRLOG_DISABLE to compile all logging out. The arguments
+// are never evaluated, but still checked against the format and counted
+// as used, so that build stays warning-clean.
+__attribute__(( format( printf, 1, 2 ) ))
+static inline void errLogNop( const char * formatted_string, ... ) {
+    (void)formatted_string;
+}
+#define errLog( ... ) do { if( 0 ) errLogNop( __VA_ARGS__ ); } while( 0 )
+#define errLogLevel( level, ... ) do { if( 0 ) { (void)( level ); errLogNop( __VA_ARGS__ ); } } while( 0 )
+#define errLogLimited( level, ... ) errLogLevel( level, __VA_ARGS__ )
+
+#endif // ERRLOG_DISABLE
+
+int errRateLimit( ErrRateLimit * rl );
+
+// Variadic function wrapper for logging formatted messages.
+// This should only be used by errLog() and errQuit().
+void errLogVaList( int level, char * formatted_string, va_list args );
+
+#endif // ERROR_HANDLER_H
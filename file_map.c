@@ -0,0 +1,90 @@
+#include "file_map.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FILE_MAP_USE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+bool fileMapOpen( FileMap * fm, const char * filename ) {
+	fm->data = NULL;
+	fm->size = 0;
+	fm->mapped = false;
+
+#ifdef FILE_MAP_USE_MMAP
+	int fd = open( filename, O_RDONLY );
+	if( fd < 0 ) {
+		return false;
+	}
+	struct stat st;
+	if( fstat( fd, &st ) != 0 ) {
+		errLog( "fileMapOpen(): fstat() failed on %s", filename );
+		close( fd );
+		return false;
+	}
+	fm->size = (size_t)st.st_size;
+	if( fm->size > 0 ) {
+		// MAP_PRIVATE + PROT_WRITE gives copy-on-write pages, so callers may
+		// use the mapping as scratch without touching the file on disk.
+		void * p = mmap( NULL, fm->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+		if( p == MAP_FAILED ) {
+			errLog( "fileMapOpen(): mmap() failed on %s", filename );
+			close( fd );
+			return false;
+		}
+		fm->data = p;
+		fm->mapped = true;
+	}
+	close( fd );
+	return true;
+#else
+	FILE * f = fopen( filename, "rb" );
+	if( !f ) {
+		return false;
+	}
+	fseek( f, 0, SEEK_END );
+	long len = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	if( len < 0 ) {
+		errLog( "fileMapOpen(): ftell() failed on %s", filename );
+		fclose( f );
+		return false;
+	}
+	fm->size = (size_t)len;
+	if( fm->size > 0 ) {
+		fm->data = malloc( fm->size );
+		if( !fm->data ) {
+			errLog( "fileMapOpen(): malloc() failed on %s (%zu bytes)", filename, fm->size );
+			fclose( f );
+			return false;
+		}
+		if( fread( fm->data, 1, fm->size, f ) != fm->size ) {
+			errLog( "fileMapOpen(): short read on %s", filename );
+			free( fm->data );
+			fm->data = NULL;
+			fclose( f );
+			return false;
+		}
+	}
+	fclose( f );
+	return true;
+#endif
+}
+
+void fileMapClose( FileMap * fm ) {
+	if( !fm->data ) {
+		return;
+	}
+#ifdef FILE_MAP_USE_MMAP
+	if( fm->mapped ) {
+		munmap( fm->data, fm->size );
+	}
+#else
+	free( fm->data );
+#endif
+	fm->data = NULL;
+	fm->size = 0;
+	fm->mapped = false;
+}
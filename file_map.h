@@ -0,0 +1,20 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "error_handler.h"
+
+// Read-only view of a whole file. On POSIX systems the file is mmap()ed;
+// elsewhere it is read into a single heap buffer with one fread().
+typedef struct FileMap_t {
+	unsigned char * data;
+	size_t size;
+	bool mapped;
+} FileMap;
+
+bool fileMapOpen( FileMap * fm, const char * filename );
+void fileMapClose( FileMap * fm );
+
+#endif // FILE_MAP_H
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "glyph.h"
+#include "error_handler.h"
+
+// Code page 437 as drawn on the IBM PC, including the graphic forms of the
+// control bytes.
+static const uint16_t cp437[256] = {
+	0x0000, 0x263a, 0x263b, 0x2665, 0x2666, 0x2663, 0x2660, 0x2022, 0x25d8, 0x25cb, 0x25d9, 0x2642, 0x2640, 0x266a, 0x266b, 0x263c,
+	0x25ba, 0x25c4, 0x2195, 0x203c, 0x00b6, 0x00a7, 0x25ac, 0x21a8, 0x2191, 0x2193, 0x2192, 0x2190, 0x221f, 0x2194, 0x25b2, 0x25bc,
+	0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027, 0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+	0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+	0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047, 0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+	0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057, 0x0058, 0x0059, 0x005a, 0x005b, 0x005c, 0x005d, 0x005e, 0x005f,
+	0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067, 0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077, 0x0078, 0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x007e, 0x2302,
+	0x00c7, 0x00fc, 0x00e9, 0x00e2, 0x00e4, 0x00e0, 0x00e5, 0x00e7, 0x00ea, 0x00eb, 0x00e8, 0x00ef, 0x00ee, 0x00ec, 0x00c4, 0x00c5,
+	0x00c9, 0x00e6, 0x00c6, 0x00f4, 0x00f6, 0x00f2, 0x00fb, 0x00f9, 0x00ff, 0x00d6, 0x00dc, 0x00a2, 0x00a3, 0x00a5, 0x20a7, 0x0192,
+	0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00f1, 0x00d1, 0x00aa, 0x00ba, 0x00bf, 0x2310, 0x00ac, 0x00bd, 0x00bc, 0x00a1, 0x00ab, 0x00bb,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255d, 0x255c, 0x255b, 0x2510,
+	0x2514, 0x2534, 0x252c, 0x251c, 0x2500, 0x253c, 0x255e, 0x255f, 0x255a, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256c, 0x2567,
+	0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256b, 0x256a, 0x2518, 0x250c, 0x2588, 0x2584, 0x258c, 0x2590, 0x2580,
+	0x03b1, 0x00df, 0x0393, 0x03c0, 0x03a3, 0x03c3, 0x00b5, 0x03c4, 0x03a6, 0x0398, 0x03a9, 0x03b4, 0x221e, 0x03c6, 0x03b5, 0x2229,
+	0x2261, 0x00b1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00f7, 0x2248, 0x00b0, 0x2219, 0x00b7, 0x221a, 0x207f, 0x00b2, 0x25a0, 0x00a0,
+};
+
+uint32_t glyphFromCp437( int byte ) {
+	return cp437[byte & 0xff];
+}
+
+// An empty table with one reference.
+GlyphTable * glyphTableNew( void ) {
+	GlyphTable * t = malloc( sizeof(GlyphTable) );
+	if( !t ) {
+		errLog( "glyphTableNew(): malloc() failed on glyph table" );
+		return NULL;
+	}
+	atomic_init( &t->refs, 1 );
+	atomic_init( &t->n, 0 );
+	memset( t->hash, 0, sizeof(t->hash) );
+	return t;
+}
+
+// A table of its own holding t's glyphs at the same indices, with one
+// reference.
+GlyphTable * glyphTableCopy( const GlyphTable * t ) {
+	GlyphTable * copy = glyphTableNew();
+	if( copy ) {
+		atomic_store_explicit( &copy->n, atomic_load_explicit( &t->n, memory_order_acquire ), memory_order_relaxed );
+		memcpy( copy->cp, t->cp, sizeof(copy->cp) );
+		memcpy( copy->hash, t->hash, sizeof(copy->hash) );
+	}
+	return copy;
+}
+
+GlyphTable * glyphTableRetain( GlyphTable * t ) {
+	if( t ) {
+		atomic_fetch_add( &t->refs, 1 );
+	}
+	return t;
+}
+
+void glyphTableRelease( GlyphTable * t ) {
+	if( t && atomic_fetch_sub( &t->refs, 1 ) == 1 ) {
+		free( t );
+	}
+}
+
+static inline unsigned glyphHash( uint32_t cp ) {
+	return ( cp * 2654435761u ) >> 24;
+}
+
+/*  Index for cp, adding it to the table if it is new. Returns -1 when the
+    table is full or cp is not a code point (surrogates, > U+10FFFF).     */
+int glyphIntern( GlyphTable * t, uint32_t cp ) {
+	if( cp < GLYPH_ASCII_END ) {
+		return (int)cp;
+	}
+	if( cp > GLYPH_MAX_CODE_POINT || ( cp >= 0xd800 && cp <= 0xdfff ) ) {
+		return -1;
+	}
+	unsigned h = glyphHash( cp );
+	for( ;; h = ( h + 1 ) % GLYPH_HASH_SIZE ) {
+		int slot = t->hash[h];
+		if( slot == 0 ) {
+			break;
+		}
+		if( t->cp[slot - 1] == cp ) {
+			return GLYPH_ASCII_END + slot - 1;
+		}
+	}
+	int n = atomic_load_explicit( &t->n, memory_order_relaxed );
+	if( n == GLYPH_TABLE_SIZE ) {
+		return -1;
+	}
+	t->cp[n] = cp;
+	t->hash[h] = n + 1;
+	atomic_store_explicit( &t->n, n + 1, memory_order_release );
+	return GLYPH_ASCII_END + n;
+}
+
+// True if every glyph of a has the same index in b, so cells can be copied
+// from a board using a to one using b as they are.
+bool glyphTablePrefixOf( const GlyphTable * a, const GlyphTable * b ) {
+	if( !a || a->n == 0 || a == b ) {
+		return true;
+	}
+	return b && b->n >= a->n && memcmp( a->cp, b->cp, a->n * sizeof(uint32_t) ) == 0;
+}
+
+void glyphMapInit( GlyphMap * m, const GlyphTable * from, GlyphTable * to ) {
+	m->from = from;
+	m->to = to;
+	memset( m->idx, 0xff, sizeof(m->idx) );
+}
+
+// Index in m->to for index in m->from, interning on first use. Glyphs that
+// do not fit become GLYPH_REPLACEMENT.
+int glyphMapIndex( GlyphMap * m, int index ) {
+	if( index < GLYPH_ASCII_END ) {
+		return index;
+	}
+	int i = index - GLYPH_ASCII_END;
+	if( m->idx[i] < 0 ) {
+		int to = m->to ? glyphIntern( m->to, glyphCodePoint( m->from, index ) ) : -1;
+		m->idx[i] = to < 0 ? GLYPH_REPLACEMENT : to;
+	}
+	return m->idx[i];
+}
+
+// UTF-8 encoding of cp into out (at least 4 bytes). Returns the length.
+int glyphToUtf8( uint32_t cp, char * out ) {
+	if( cp < 0x80 ) {
+		out[0] = cp;
+		return 1;
+	}
+	if( cp < 0x800 ) {
+		out[0] = 0xc0 | ( cp >> 6 );
+		out[1] = 0x80 | ( cp & 0x3f );
+		return 2;
+	}
+	if( cp < 0x10000 ) {
+		out[0] = 0xe0 | ( cp >> 12 );
+		out[1] = 0x80 | ( ( cp >> 6 ) & 0x3f );
+		out[2] = 0x80 | ( cp & 0x3f );
+		return 3;
+	}
+	out[0] = 0xf0 | ( cp >> 18 );
+	out[1] = 0x80 | ( ( cp >> 12 ) & 0x3f );
+	out[2] = 0x80 | ( ( cp >> 6 ) & 0x3f );
+	out[3] = 0x80 | ( cp & 0x3f );
+	return 4;
+}
@@ -0,0 +1,62 @@
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*  Glyph intern tables. A cell's 8-bit pattern is a glyph index: indices
+    below GLYPH_ASCII_END are the ASCII characters themselves, and the rest
+    name the code points interned in the board's table, in the order they
+    were first used. So a cell stays one word whatever it shows, and a
+    board of box-drawing characters costs what an ASCII one does.
+
+    Tables only ever grow, so an index, once handed out, keeps its meaning.
+    They are reference counted: boards copied from one another (selections,
+    snapshots, animation frames) share one table, and cells move between
+    them without translation.                                            */
+
+#define GLYPH_ASCII_END 128
+#define GLYPH_TABLE_SIZE 128        // Interned glyphs: indices 128..255.
+#define GLYPH_HASH_SIZE 256         // Open addressing, so at most half full.
+#define GLYPH_REPLACEMENT '?'       // Shown for unknown indices, used when full.
+#define GLYPH_MAX_CODE_POINT 0x10ffff
+
+typedef struct GlyphTable_t {
+	atomic_int refs;
+	// Only the UI thread interns, but save workers read shared tables:
+	// n is stored with release after cp[n] is written, so a thread that
+	// loads it (acquire) sees that many code points.
+	atomic_int n;
+	uint32_t cp[GLYPH_TABLE_SIZE];      // Code point of index GLYPH_ASCII_END + i.
+	uint8_t hash[GLYPH_HASH_SIZE];      // Slot + 1 of each code point, 0 = empty.
+} GlyphTable;
+
+// Lazily built translation of indices from one table into another.
+typedef struct GlyphMap_t {
+	const GlyphTable * from;
+	GlyphTable * to;
+	int16_t idx[GLYPH_TABLE_SIZE];      // -1 until first used.
+} GlyphMap;
+
+GlyphTable * glyphTableNew( void );
+GlyphTable * glyphTableCopy( const GlyphTable * t );
+GlyphTable * glyphTableRetain( GlyphTable * t );
+void glyphTableRelease( GlyphTable * t );
+int glyphIntern( GlyphTable * t, uint32_t cp );
+bool glyphTablePrefixOf( const GlyphTable * a, const GlyphTable * b );
+void glyphMapInit( GlyphMap * m, const GlyphTable * from, GlyphTable * to );
+int glyphMapIndex( GlyphMap * m, int index );
+uint32_t glyphFromCp437( int byte );
+int glyphToUtf8( uint32_t cp, char * out );
+
+// Code point for a glyph index. t may be NULL (an ASCII-only board).
+static inline uint32_t glyphCodePoint( const GlyphTable * t, int index ) {
+	if( index < GLYPH_ASCII_END ) {
+		return index;
+	}
+	index -= GLYPH_ASCII_END;
+	return ( t && index < t->n ) ? t->cp[index] : GLYPH_REPLACEMENT;
+}
+
+#endif // GLYPH_H
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "layer.h"
+#include "byte_order.h"
+#include "profile.h"
+
+// A one-layer stack over base, which the caller keeps ownership of.
+LayerStack * layerStackInit( Board * base ) {
+	LayerStack * stack = malloc( sizeof(LayerStack) );
+	if( !stack ) {
+		errLog( "layerStackInit(): malloc() failed on stack" );
+		return NULL;
+	}
+	stack->w = base->w;
+	stack->h = base->h;
+	stack->n = 1;
+	stack->base_owned = false;
+	stack->background = cellMake( ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	stack->layers[0] = (Layer){ base, true, NULL };
+	stack->full = true;
+	stack->composite = boardInit( base->w, base->h, base->color_enabled );
+	stack->row = malloc( (size_t)base->w * sizeof(Cell) );
+	if( !stack->composite || !stack->row ) {
+		errLog( "layerStackInit(): allocation failed on %dx%d composite", base->w, base->h );
+		boardFree( stack->composite );
+		free( stack->row );
+		free( stack );
+		return NULL;
+	}
+	return stack;
+}
+
+void layerStackFree( LayerStack * stack ) {
+	if( stack ) {
+		int i;
+		for( i = stack->base_owned ? 0 : 1; i < stack->n; i++ ) {
+			boardFree( stack->layers[i].board );
+		}
+		boardFree( stack->composite );
+		free( stack->row );
+		free( stack );
+	}
+}
+
+// Insert a new, all transparent layer at index at (1..n). Returns it, or
+// NULL when the stack is full.
+Board * layerStackAdd( LayerStack * stack, int at ) {
+	if( stack->n == LAYER_MAX || at < 1 || at > stack->n ) {
+		errLog( "layerStackAdd(): no room for a layer at %d (%d of %d used)", at, stack->n, LAYER_MAX );
+		return NULL;
+	}
+	Board * board = boardAlloc( stack->w, stack->h, stack->layers[0].board->color_enabled );
+	if( !board ) {
+		return NULL;
+	}
+	boardWipe( board, CELL_TRANSPARENT, 0, 0, 0, 0 );
+	// Share the base's glyphs, so the layers usually need no translating.
+	board->glyphs = glyphTableRetain( stack->layers[0].board->glyphs );
+	memmove( stack->layers + at + 1, stack->layers + at, ( stack->n - at ) * sizeof(Layer) );
+	stack->layers[at] = (Layer){ board, true, board };
+	stack->n++;
+	boardClearDirty( board );
+	return board;
+}
+
+// Free layer at (1..n-1).
+bool layerStackRemove( LayerStack * stack, int at ) {
+	if( at < 1 || at >= stack->n ) {
+		return false;
+	}
+	boardFree( stack->layers[at].board );
+	stack->n--;
+	memmove( stack->layers + at, stack->layers + at + 1, ( stack->n - at ) * sizeof(Layer) );
+	stack->full = true;
+	return true;
+}
+
+// Move layer at to index to, shifting the ones between. Neither may be
+// the base.
+bool layerStackMove( LayerStack * stack, int at, int to ) {
+	if( at < 1 || at >= stack->n || to < 1 || to >= stack->n ) {
+		return false;
+	}
+	Layer moved = stack->layers[at];
+	if( to > at ) {
+		memmove( stack->layers + at, stack->layers + at + 1, ( to - at ) * sizeof(Layer) );
+	}
+	else {
+		memmove( stack->layers + to + 1, stack->layers + to, ( at - to ) * sizeof(Layer) );
+	}
+	stack->layers[to] = moved;
+	stack->full = true;
+	return true;
+}
+
+void layerStackSetVisible( LayerStack * stack, int at, bool visible ) {
+	if( stack->layers[at].visible != visible ) {
+		stack->layers[at].visible = visible;
+		stack->full = true;
+	}
+}
+
+/*  Flatten x0..x1 of row y into the composite. The cells are built in
+    stack->row bottom layer first, each layer overwriting what it doesn't
+    leave transparent; then only the runs that differ from the composite
+    are stored and marked dirty, unless force is set.                    */
+static void compositeSpan( LayerStack * stack, GlyphMap * maps, const bool * remap, int y, int x0, int x1, bool force ) {
+	Board * comp = stack->composite;
+	Cell * row = stack->row;
+	int i, x, k, len;
+
+	for( x = x0; x <= x1; x++ ) {
+		row[x] = stack->background;
+	}
+	for( i = 0; i < stack->n; i++ ) {
+		Board * b = stack->layers[i].board;
+		if( !stack->layers[i].visible ) {
+			continue;
+		}
+		for( x = x0; x <= x1; x += len ) {
+			const Cell * c = boardSpan( b, x, y, &len );
+			if( len > x1 - x + 1 ) {
+				len = x1 - x + 1;
+			}
+			// An untouched sparse tile of a layer is all transparent.
+			if( b->empty_tile && c >= b->empty_tile && c < b->empty_tile + BOARD_TILE_CELLS && b->empty_tile[0] == CELL_TRANSPARENT ) {
+				continue;
+			}
+			for( k = 0; k < len; k++ ) {
+				if( c[k] != CELL_TRANSPARENT ) {
+					row[x + k] = remap[i] ? cellSetPattern( c[k], glyphMapIndex( &maps[i], cellPattern( c[k] ) ) ) : c[k];
+				}
+			}
+		}
+	}
+
+	for( x = x0; x <= x1; x += len ) {
+		const Cell * c = boardSpan( comp, x, y, &len );
+		if( len > x1 - x + 1 ) {
+			len = x1 - x + 1;
+		}
+		int first = 0, last = len - 1;
+		if( !force ) {
+			for( ; first < len && c[first] == row[x + first]; first++ );
+			if( first == len ) {
+				continue;
+			}
+			for( ; c[last] == row[x + last]; last-- );
+		}
+		int run;
+		Cell * dst = boardSpanWritable( comp, x, y, &run );
+		if( !dst ) {
+			break;
+		}
+		memcpy( dst + first, row + x + first, ( last - first + 1 ) * sizeof(Cell) );
+		boardMarkDirty( comp, x + first, y, last - first + 1, 1 );
+	}
+}
+
+/*  Bring the composite up to date with every layer and return it. Layers'
+    dirty spans are consumed: a cell is recomposited if any visible layer
+    changed it, and the spans of all layers are cleared afterwards.      */
+Board * layerStackComposite( LayerStack * stack ) {
+	Board * comp = stack->composite;
+	bool full = stack->full;
+	int i, y;
+
+	for( i = 0; i < stack->n; i++ ) {
+		if( stack->layers[i].board != stack->layers[i].seen ) {
+			stack->layers[i].seen = stack->layers[i].board;
+			full = true;
+		}
+	}
+	// A full pass starts the composite's glyph table over, so glyphs no
+	// longer used anywhere don't fill it up. Every cell is then stored,
+	// since a matching pattern may now mean another glyph.
+	if( full ) {
+		glyphTableRelease( comp->glyphs );
+		comp->glyphs = NULL;
+	}
+
+	GlyphMap maps[LAYER_MAX];
+	bool remap[LAYER_MAX];
+	int y0 = full ? 0 : INT_MAX;
+	int y1 = full ? stack->h - 1 : -1;
+	for( i = 0; i < stack->n; i++ ) {
+		Board * b = stack->layers[i].board;
+		remap[i] = false;
+		if( !stack->layers[i].visible ) {
+			continue;
+		}
+		// The composite interns every layer's glyphs, so it needs a table of
+		// its own; starting from the first layer's keeps that one unmapped.
+		if( b->glyphs && !comp->glyphs ) {
+			comp->glyphs = glyphTableCopy( b->glyphs );
+		}
+		remap[i] = !glyphTablePrefixOf( b->glyphs, comp->glyphs );
+		if( remap[i] ) {
+			glyphMapInit( &maps[i], b->glyphs, comp->glyphs );
+		}
+		if( b->dirty_y0 < y0 ) {
+			y0 = b->dirty_y0;
+		}
+		if( b->dirty_y1 > y1 ) {
+			y1 = b->dirty_y1;
+		}
+	}
+
+	PROF_BEGIN( t_composite );
+	uint64_t cells = 0;
+	for( y = y0; y <= y1; y++ ) {
+		int x0 = full ? 0 : INT_MAX;
+		int x1 = full ? stack->w - 1 : -1;
+		for( i = 0; i < stack->n; i++ ) {
+			Board * b = stack->layers[i].board;
+			if( stack->layers[i].visible ) {
+				if( b->dirty_x0[y] < x0 ) {
+					x0 = b->dirty_x0[y];
+				}
+				if( b->dirty_x1[y] > x1 ) {
+					x1 = b->dirty_x1[y];
+				}
+			}
+		}
+		if( x0 <= x1 ) {
+			compositeSpan( stack, maps, remap, y, x0, x1, full );
+			cells += x1 - x0 + 1;
+		}
+	}
+	if( y0 <= y1 ) {
+		PROF_END( t_composite, PROF_COMPOSITE );
+		profCount( PROF_CELLS_COMPOSITED, cells );
+	}
+
+	for( i = 0; i < stack->n; i++ ) {
+		boardClearDirty( stack->layers[i].board );
+	}
+	stack->full = false;
+	return comp;
+}
+
+bool layerStackSave( LayerStack * stack, char * filename ) {
+	unsigned char head[LAYER_HEADER_SIZE + LAYER_MAX * LAYER_ENTRY_SIZE];
+	size_t head_len = LAYER_HEADER_SIZE + (size_t)stack->n * LAYER_ENTRY_SIZE;
+	int i;
+	memset( head, 0, head_len );
+	memcpy( head, LAYER_MAGIC, LAYER_MAGIC_LEN );
+	putU16LE( head + 4, LAYER_VERSION );
+	putU32LE( head + 8, stack->w );
+	putU32LE( head + 12, stack->h );
+	putU32LE( head + 16, stack->n );
+	putU32LE( head + 20, stack->background );
+	for( i = 0; i < stack->n; i++ ) {
+		unsigned char * e = head + LAYER_HEADER_SIZE + i * LAYER_ENTRY_SIZE;
+		uint64_t size = boardBinarySize( stack->layers[i].board );
+		putU32LE( e, stack->layers[i].visible ? LAYER_FLAG_VISIBLE : 0 );
+		putU32LE( e + 8, (uint32_t)size );
+		putU32LE( e + 12, (uint32_t)( size >> 32 ) );
+	}
+
+	char tmp_name[FILENAME_MAX];
+	FILE * f = saveOpen( filename, tmp_name, sizeof(tmp_name), "wb" );
+	if( !f ) {
+		return false;
+	}
+	bool ok = fwrite( head, 1, head_len, f ) == head_len;
+	for( i = 0; i < stack->n && ok; i++ ) {
+		ok = boardWriteBinary( stack->layers[i].board, f );
+	}
+	return saveClose( f, tmp_name, filename, ok );
+}
+
+// True if filename starts with the .brl magic.
+bool layerFileCheck( const char * filename ) {
+	char magic[LAYER_MAGIC_LEN];
+	FILE * f = fopen( filename, "rb" );
+	if( !f ) {
+		return false;
+	}
+	bool is_layered = fread( magic, 1, LAYER_MAGIC_LEN, f ) == LAYER_MAGIC_LEN && memcmp( magic, LAYER_MAGIC, LAYER_MAGIC_LEN ) == 0;
+	fclose( f );
+	return is_layered;
+}
+
+// Load a .brl document. The stack owns all its layers, base included.
+LayerStack * layerStackLoad( char * filename ) {
+	FileMap fm;
+	if( !fileMapOpen( &fm, filename ) ) {
+		errLog( "layerStackLoad(): Could not load %s", filename );
+		return NULL;
+	}
+	const unsigned char * data = fm.data;
+	uint32_t n = fm.size >= LAYER_HEADER_SIZE ? getU32LE( data + 16 ) : 0;
+	if( fm.size < LAYER_HEADER_SIZE || memcmp( data, LAYER_MAGIC, LAYER_MAGIC_LEN ) != 0 ) {
+		errLog( "layerStackLoad(): %s is not a layered board", filename );
+		fileMapClose( &fm );
+		return NULL;
+	}
+	if( getU16LE( data + 4 ) != LAYER_VERSION || n < 1 || n > LAYER_MAX || fm.size < LAYER_HEADER_SIZE + n * LAYER_ENTRY_SIZE ) {
+		errLog( "layerStackLoad(): %s has an unsupported version or a bad layer count (%u)", filename, n );
+		fileMapClose( &fm );
+		return NULL;
+	}
+
+	LayerStack * stack = NULL;
+	size_t at = LAYER_HEADER_SIZE + n * LAYER_ENTRY_SIZE;
+	uint32_t i;
+	for( i = 0; i < n; i++ ) {
+		const unsigned char * e = data + LAYER_HEADER_SIZE + i * LAYER_ENTRY_SIZE;
+		uint64_t size = getU32LE( e + 8 ) | ( (uint64_t)getU32LE( e + 12 ) << 32 );
+		if( size > fm.size - at ) {
+			errLog( "layerStackLoad(): %s is truncated in layer %u", filename, i );
+			break;
+		}
+		Board * board = boardLoadFromMemory( data + at, size, filename );
+		if( !board ) {
+			break;
+		}
+		at += size;
+		if( board->w != (int)getU32LE( data + 8 ) || board->h != (int)getU32LE( data + 12 ) ) {
+			errLog( "layerStackLoad(): %s: layer %u is %dx%d, the document %ux%u", filename, i, board->w, board->h, getU32LE( data + 8 ), getU32LE( data + 12 ) );
+			boardFree( board );
+			break;
+		}
+		if( i == 0 ) {
+			stack = layerStackInit( board );
+			if( !stack ) {
+				boardFree( board );
+				break;
+			}
+			stack->base_owned = true;
+			stack->background = getU32LE( data + 20 );
+		}
+		else {
+			stack->layers[i] = (Layer){ board, true, NULL };
+			stack->n++;
+		}
+		stack->layers[i].visible = ( getU32LE( e ) & LAYER_FLAG_VISIBLE ) != 0;
+	}
+	fileMapClose( &fm );
+	if( stack && i < n ) {
+		layerStackFree( stack );
+		return NULL;
+	}
+	return stack;
+}
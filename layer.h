@@ -0,0 +1,84 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "board.h"
+
+/*  Layered documents. A LayerStack is up to LAYER_MAX boards of one size,
+    stacked bottom to top. Cells equal to CELL_TRANSPARENT let the layers
+    below show through; where every visible layer is transparent the stack
+    shows its background cell.
+
+    The flattened result is kept in stack->composite, which is what gets
+    drawn and exported. layerStackComposite() brings it up to date
+    incrementally: layers are never drawn themselves, so their dirty spans
+    are free to say which cells changed since the last pass, and only the
+    cells under them are recomposited. Of those, only cells whose flattened
+    value changed are written to the composite and marked dirty there, so
+    boardDrawDirty() on it repaints no more than it has to. Adding,
+    removing, reordering or hiding a layer, or swapping a layer's board
+    (load, undo of a load), recomposites everything once.
+
+    Layer 0 is the base. The stack borrows it (in the editor it is the
+    current animation frame) unless base_owned is set, as it is for stacks
+    loaded from a file; the layers above it always belong to the stack.
+    The base stays at the bottom: it can't be removed or moved.
+
+    .brl file layout. All integers are little-endian.
+      0  char[4]   magic "BRDL"
+      4  u16       version (LAYER_VERSION)
+      6  u16       reserved, 0
+      8  u32       width
+     12  u32       height
+     16  u32       layer count n
+     20  u32       background cell
+     24  entry[n]  per layer, bottom first, LAYER_ENTRY_SIZE each:
+                     u32 flags (LAYER_FLAG_*)
+                     u32 reserved, 0
+                     u64 payload size
+     ..  payloads: complete binary .brd v2 files, back to back.          */
+#define LAYER_MAGIC "BRDL"
+#define LAYER_MAGIC_LEN 4
+#define LAYER_VERSION 1
+#define LAYER_HEADER_SIZE 24
+#define LAYER_ENTRY_SIZE 16
+#define LAYER_FLAG_VISIBLE 0x0001
+
+#define LAYER_MAX 16
+
+// Pattern 0 (NUL) on black: never drawn as itself, so it is free to mean
+// "nothing here". New layers start out all transparent.
+#define CELL_TRANSPARENT 0
+
+typedef struct Layer_t {
+	Board * board;
+	bool visible;
+	Board * seen;       // board as of the last pass; a new one is recomposited in full.
+} Layer;
+
+typedef struct LayerStack_t {
+	int w;
+	int h;
+	Layer layers[LAYER_MAX];    // Bottom first.
+	int n;
+	bool base_owned;            // layerStackFree() frees layers[0].board too.
+	Cell background;
+	Board * composite;
+	bool full;                  // Recomposite every cell on the next pass.
+	Cell * row;                 // Scratch, one row of w cells.
+} LayerStack;
+
+LayerStack * layerStackInit( Board * base );
+void layerStackFree( LayerStack * stack );
+Board * layerStackAdd( LayerStack * stack, int at );
+bool layerStackRemove( LayerStack * stack, int at );
+bool layerStackMove( LayerStack * stack, int at, int to );
+void layerStackSetVisible( LayerStack * stack, int at, bool visible );
+Board * layerStackComposite( LayerStack * stack );
+bool layerStackSave( LayerStack * stack, char * filename );
+bool layerFileCheck( const char * filename );
+LayerStack * layerStackLoad( char * filename );
+
+#endif // LAYER_H
@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "curses.h"
 
@@ -10,6 +12,153 @@
 #include "curses_wrapper.h"
 #include "draw.h"
 #include "board.h"
+#include "undo.h"
+#include "autosave.h"
+#include "profile.h"
+#include "anim.h"
+#include "layer.h"
+#include "trace.h"
+#include "pair_cache.h"
+#include "clipboard.h"
+
+// Refit the viewport after the live board is replaced, and keep the cursor on it.
+static void fitToBoard( Board * board, Viewport * vp, Coord * cursor, int reserve_h ) {
+	viewportFit( vp, 1, 1, 1, reserve_h, board->w, board->h );
+	if( cursor->x > board->w - 1 ) {
+		cursor->x = board->w - 1;
+	}
+	if( cursor->y > board->h - 1 ) {
+		cursor->y = board->h - 1;
+	}
+}
+
+/*  Frame pacing. Keys are still handled one per loop iteration, but the
+    screen is only redrawn once no more keys are queued, so a burst of
+    input (key repeat, pasted text) costs one frame rather than one per key.
+    budget_ms bounds how long queued keys may hold off a redraw; max_fps,
+    if set, keeps redraws at least 1000 / max_fps ms apart.               */
+#define FRAME_BUDGET_MS 16
+#define IDLE_TICK_MS 1000       // getch() timeout, so periodic work runs while idle.
+
+typedef struct FramePacer_t {
+	int budget_ms;
+	int max_fps;            // 0: uncapped.
+	long frame_start;       // When the first key of this frame arrived, or -1.
+	long last_draw;
+} FramePacer;
+
+static long nowMs( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// Wait up to wait_ms (-1: forever) for the next key. Returns ERR on timeout.
+static int pacedGetch( FramePacer * fp, int wait_ms ) {
+	timeout( wait_ms );
+	int key = getch();
+	if( key != ERR && fp->frame_start < 0 ) {
+		fp->frame_start = nowMs();
+	}
+	return key;
+}
+
+// Peek for a key that arrives within wait_ms, leaving it queued.
+static bool keyPending( int wait_ms ) {
+	timeout( wait_ms );
+	int key = getch();
+	if( key == ERR ) {
+		return false;
+	}
+	ungetch( key );
+	return true;
+}
+
+// True when the frame should be drawn now.
+static bool framePacerDue( FramePacer * fp ) {
+	long now = nowMs();
+	bool queued = keyPending( 0 );
+	if( queued && fp->frame_start >= 0 && now - fp->frame_start < fp->budget_ms ) {
+		return false;
+	}
+	if( fp->max_fps > 0 ) {
+		long wait = fp->last_draw + 1000 / fp->max_fps - now;
+		if( wait > 0 && ( queued || keyPending( wait ) ) ) {
+			return false;
+		}
+	}
+	fp->last_draw = nowMs();
+	fp->frame_start = -1;
+	return true;
+}
+
+// Make board (a frame or a layer) the one being edited. Undo history
+// belongs to one board, so it starts over.
+static Board * editBoard( Board * board, UndoJournal * journal ) {
+	if( journal ) {
+		undoClear( journal );
+		undoAttach( journal, board );
+	}
+	return board;
+}
+
+// Animations and layered boards aren't boards, and board-only tools can't
+// read them, so don't let them overwrite a .brd: swap name's .brd for ext
+// (the same length), saying so.
+static void keepOffBrd( char * name, const char * ext ) {
+	size_t n = strlen( name );
+	if( n >= 4 && strcmp( name + n - 4, ".brd" ) == 0 ) {
+		errLog( "%s is for single boards; saving to %.*s%s instead.", name, (int)( n - 4 ), name, ext );
+		strcpy( name + n - 4, ext );
+	}
+}
+
+// A fresh one-layer stack over base, replacing old. Used when the base
+// changes size, which only a document without extra layers can do.
+static LayerStack * resetLayers( LayerStack * old, Board * base ) {
+	LayerStack * stack = layerStackInit( base );
+	if( !stack ) {
+		errQuit( "resetLayers(): could not make a layer stack for a %dx%d board", base->w, base->h );
+	}
+	layerStackFree( old );
+	return stack;
+}
+
+/*  The pen is a code point rather than a pattern, since patterns above
+    ASCII only mean something on the board whose table they index. It is
+    interned into the board when it is put down, not while cycling, so
+    browsing glyphs doesn't fill the table. '[' and ']' step through
+    printable ASCII and then the upper half of code page 437.            */
+#define PEN_ASCII_FIRST 32
+#define PEN_ASCII_LAST 126
+#define PEN_STEPS ( PEN_ASCII_LAST - PEN_ASCII_FIRST + 1 + 128 )
+
+static uint32_t penAt( int step ) {
+	step = ( step % PEN_STEPS + PEN_STEPS ) % PEN_STEPS;
+	if( step <= PEN_ASCII_LAST - PEN_ASCII_FIRST ) {
+		return PEN_ASCII_FIRST + step;
+	}
+	return glyphFromCp437( 128 + step - ( PEN_ASCII_LAST - PEN_ASCII_FIRST + 1 ) );
+}
+
+// The pen dir steps from pen; a pen off the cycle starts it over.
+static uint32_t penStep( uint32_t pen, int dir ) {
+	int i;
+	for( i = 0; i < PEN_STEPS && penAt( i ) != pen; i++ );
+	return penAt( i < PEN_STEPS ? i + dir : 0 );
+}
+
+// Step through the colors the terminal can show: the classic eight, or up
+// to the whole 256-color palette.
+static int cycleColor( int color, int dir ) {
+	int n = pair_cache.n_colors > N_COLORS ? pair_cache.n_colors : N_COLORS;
+	return ( color + dir + n ) % n;
+}
+
+// primary's colors with the pen's glyph, as a cell of board.
+static Cell penCell( Board * board, Cell primary, uint32_t pen ) {
+	return cellSetPattern( primary, boardInternGlyph( board, pen ) );
+}
 
 int main( int argc, char * argv[] ) {
 
@@ -26,31 +175,111 @@ int main( int argc, char * argv[] ) {
     errLog( "    ** Logging new session **");
 
 
-	if( init_curses() != 0 ) {
+	// Command line: draw [-b frame_budget_ms] [-r max_fps] [-p profile.csv|.json]
+	//                   [-R record.trc | -T replay.trc [-C checksum]] [width height]
+	FramePacer pacer = { FRAME_BUDGET_MS, 0, -1, 0 };
+	const char * profile_file = NULL;
+	char * record_file = NULL;
+	char * replay_file = NULL;
+	const char * expect_checksum = NULL;
+	int opt;
+	while( ( opt = getopt( argc, argv, "b:r:p:R:T:C:" ) ) != -1 ) {
+		if( opt == 'b' ) {
+			pacer.budget_ms = atoi( optarg );
+		}
+		else if( opt == 'r' ) {
+			pacer.max_fps = atoi( optarg );
+		}
+		else if( opt == 'p' ) {
+			profile_file = optarg;
+		}
+		else if( opt == 'R' ) {
+			record_file = optarg;
+		}
+		else if( opt == 'T' ) {
+			replay_file = optarg;
+		}
+		else if( opt == 'C' ) {
+			expect_checksum = optarg;
+		}
+	}
+	int board_w = 74;
+	int board_h = 20;
+	if( argc - optind >= 2 ) {
+		board_w = atoi( argv[optind] );
+		board_h = atoi( argv[optind + 1] );
+	}
+
+	// A replayed trace brings its own board size and terminal, and runs
+	// headless; see trace.h.
+	Trace trace = {0};
+	if( replay_file ) {
+		if( !traceReplayOpen( &trace, replay_file ) ) {
+			fprintf( stderr, "Could not replay %s; see the error log.\n", replay_file );
+			return 1;
+		}
+		board_w = trace.board_w;
+		board_h = trace.board_h;
+		if( init_curses_headless( trace.lines, trace.cols, trace.term ) != 0 ) {
+			return 1;
+		}
+	}
+	else if( init_curses() != 0 ) {
 		// errLog init_curses() failed.
 		return 1;
 	}
+	if( record_file && !traceRecordOpen( &trace, record_file, board_w, board_h, nowMs() ) ) {
+		endwin();
+		fprintf( stderr, "Could not record to %s; see the error log.\n", record_file );
+		return 1;
+	}
 
-	Board * my_board = boardInit( 74, 20, true );
+	Board * my_board = boardInit( board_w, board_h, true );
 	if( !my_board ) {
 		exit(1);
 	}
+	// The document is a list of frames; my_board is the one being edited.
+	Anim * anim = animInit( my_board );
+	if( !anim ) {
+		exit(1);
+	}
+	int frame = 0;
+	// Layers stack over the current frame, which is their base (layer 0).
+	// Documents have either extra frames or extra layers, not both.
+	LayerStack * layers = layerStackInit( my_board );
+	if( !layers ) {
+		exit(1);
+	}
+	int layer = 0;
+	AnimClip * play_clip = NULL;
+	AnimPlayer * player = NULL;     // Non-NULL while previewing the animation.
 
 	int input = 0;
 	bool doodle_mode = false;
 	bool first_tick = true;
+	bool full_redraw = true;
 	bool keep_go = true;
 	int cstep_x = 1;
 	int cstep_y = 1;
 	int cstep_count = 0;
-	Cell primary;
-	primary.pattern = '#';
-	primary.fg = COLOR_WHITE;
-	primary.bg = COLOR_BLACK;
-	primary.bright = true;
-	primary.blink = false;
+	Cell primary = cellMake( '#', COLOR_WHITE, COLOR_BLACK, true, false );
+	uint32_t pen = '#';
 
-	Coord offset = {1, 1} ;
+	// The board is drawn inside a one-cell border, with the status lines
+	// underneath. Boards larger than the terminal scroll with the cursor.
+	#define STATUS_LINES 4
+	Viewport vp = {0};
+	viewportFit( &vp, 1, 1, 1, STATUS_LINES + 1, my_board->w, my_board->h );
+
+	// Edit history. Without it, editing carries on with undo unavailable.
+	UndoJournal * journal = undoInit( UNDO_DEFAULT_BUDGET );
+	if( journal ) {
+		undoAttach( journal, my_board );
+	}
+
+	// Saves ('S' and the periodic autosave) run on a worker thread.
+	Autosave autosave;
+	autosaveInit( &autosave );
 
 	bool typewriter_mode = false;
 	bool enter_input = false;
@@ -58,20 +287,64 @@ int main( int argc, char * argv[] ) {
 	char user_input[USER_INPUT_SZ] = {0};
 	strcpy( user_input, "scratch.brd" );
 	int user_input_spot = 0;
+	// user_input as of the last Enter; the autosave name, so autosave never
+	// writes to a name that is half typed.
+	char doc_name[USER_INPUT_SZ];
+	strcpy( doc_name, user_input );
 	bool skip_input_one_tick = false;
 	Coord clip_z = {0};
 	Coord clip_x = {0};
-	Board * clipboard = NULL;
+	Clipboard clipboard;
+	clipInit( &clipboard );
+	bool show_profile = false;
 
 	while( keep_go ) {
-		if( !first_tick && !skip_input_one_tick ) {
-			input = getch();
+		if( !first_tick && !skip_input_one_tick && trace.replay ) {
+			input = traceReplayKey( &trace );
+			if( input == ERR ) {
+				break;
+			}
+		}
+		else if( !first_tick && !skip_input_one_tick ) {
+			input = pacedGetch( &pacer, player ? (int)animPlayerWait( player, nowMs() ) : IDLE_TICK_MS );
+			if( input == ERR ) {
+				// Previews repaint only the cells each frame changes.
+				if( player && animPlayerTick( player, nowMs() ) ) {
+					boardDrawDirty( player->board, &vp );
+					move( vp.y + cursor.y - vp.cam_y, vp.x + cursor.x - vp.cam_x );
+					refresh();
+				}
+				autosaveTick( &autosave, my_board, doc_name );
+				continue;
+			}
+			if( record_file ) {
+				traceRecordKey( &trace, input, nowMs() );
+			}
 		}
 		if( skip_input_one_tick ) {
 			input = ERR;
 			skip_input_one_tick = false;
 		}
 
+		PROF_BEGIN( t_input );
+
+		if( input == KEY_RESIZE ) {
+			viewportFit( &vp, 1, 1, 1, STATUS_LINES + 1, my_board->w, my_board->h );
+			full_redraw = true;
+		}
+		if( player && input != ERR ) {	// Any key stops the preview.
+			animPlayerFree( player );
+			animClipFree( play_clip );
+			player = NULL;
+			play_clip = NULL;
+			full_redraw = true;
+			input = ERR;
+		}
+
+		// Each keypress is one undo step, except in doodle and typewriter
+		// modes, where the whole stroke or line is one step.
+		undoBeginStep( journal );
+
 		if( enter_input ) {
 			if( isascii( input ) && input != '\n' && input != '\r' && input != '\t' ) {
 				if( user_input_spot < USER_INPUT_SZ - 1) {
@@ -88,21 +361,23 @@ int main( int argc, char * argv[] ) {
 			}
 			if( input == '\n' ) {
 				enter_input = false;
+				strcpy( doc_name, user_input );
 				skip_input_one_tick = true;
+				PROF_END( t_input, PROF_INPUT );
 				continue;
 			}
 		}
 		else if( typewriter_mode ) {
 			if( isascii( input ) && input != '\t' && input != KEY_DC && input != '\n' ) {
-				primary.pattern = input;
-				boardPutCell( my_board, primary, cursor.x, cursor.y );
+				pen = input;
+				boardPutCell( my_board, penCell( my_board, primary, pen ), cursor.x, cursor.y );
 				if( cursor.x < my_board->w - 1 ) {
 					cursor.x++;
 				}
 			}
 			if( input == KEY_BACKSPACE ) {
-				primary.pattern = ' ';
-				boardPutCell( my_board, primary, cursor.x - 1, cursor.y );
+				pen = ' ';
+				boardPutCell( my_board, penCell( my_board, primary, pen ), cursor.x - 1, cursor.y );
 				if( cursor.x > 0 ) {
 					cursor.x--;
 				}
@@ -110,6 +385,7 @@ int main( int argc, char * argv[] ) {
 			if( input == '\n' ) {
 				typewriter_mode = false;
 				skip_input_one_tick = true;
+				PROF_END( t_input, PROF_INPUT );
 				continue;
 			}
 		}
@@ -124,19 +400,23 @@ int main( int argc, char * argv[] ) {
 				clip_x.y = cursor.y;
 			}
 			if( input == 'Z' ) {
-				// Copy to clipboard buffer
-				if( clipboard ) {
-					boardFree( clipboard );
-					clipboard = NULL;
-				}
-				clipboard = boardMakeFromSelection( my_board, clip_z.x, clip_z.y, clip_x.x - (clip_z.x - 1), clip_x.y - (clip_z.y - 1) );
+				// Copy to a new clipboard history entry
+				PROF_BEGIN( t_copy );
+				clipCopy( &clipboard, my_board, clip_z.x, clip_z.y, clip_x.x - (clip_z.x - 1), clip_x.y - (clip_z.y - 1) );
+				PROF_END( t_copy, PROF_COPY );
 			}
 			if( input == 'X' ) {
-				// Paste from clipboard buffer
-				if( clipboard ) {
-					boardCopySection( clipboard, my_board, 0, 0, clipboard->w, clipboard->h, cursor.x, cursor.y );
+				// Paste the current clipboard entry
+				Board * clip = clipCurrent( &clipboard );
+				if( clip ) {
+					PROF_BEGIN( t_paste );
+					boardBlit( clip, 0, 0, clip->w, clip->h, my_board, cursor.x, cursor.y );
+					PROF_END( t_paste, PROF_PASTE );
 				}
 			}
+			if( input == 'y' || input == 'Y' ) {
+				clipSelect( &clipboard, input == 'y' ? 1 : -1 );
+			}
 			if( input == 't' ) {
 				typewriter_mode = true;
 			}
@@ -149,41 +429,48 @@ int main( int argc, char * argv[] ) {
 				keep_go = false;
 			}
 		
-			if( input == 'r') { // reset board
-				boardWipe( my_board, ' ', COLOR_WHITE, COLOR_BLACK, true, false );
+			if( input == 'r') { // reset board (clear the layer, above the base)
+				if( layer > 0 ) {
+					boardWipe( my_board, CELL_TRANSPARENT, 0, 0, 0, 0 );
+				}
+				else {
+					boardWipe( my_board, ' ', COLOR_WHITE, COLOR_BLACK, true, false );
+				}
 			}
 			
+			if( input == 'P' ) {	// Toggle the profiling overlay
+				show_profile = !show_profile;
+			}
+
 			if( input == '\t' ) {	// Toggle doodle mode
 				doodle_mode = !doodle_mode;
 			}
 			
-			if( input == 'f' ) {	// Floodfill
+			if( input == 'f' || input == 'g' ) {	// Floodfill (g: include diagonals)
 				Cell target = boardGetCell( my_board, cursor.x, cursor.y );
-				floodFill( my_board, target, primary, cursor.x, cursor.y );
+				PROF_BEGIN( t_fill );
+				floodFill( my_board, target, penCell( my_board, primary, pen ), cursor.x, cursor.y, input == 'g' ? 8 : 4, NULL );
+				PROF_END( t_fill, PROF_FILL );
 			}
 			
-			if( input == '\n' ) {
-				primary = boardGetCell( my_board, cursor.x, cursor.y );
-				mvprintw(24, 24, "Enter!");
+			if( input == '\n' ) {	// Grab what is shown, whichever layer it is on
+				Board * shown = layerStackComposite( layers );
+				primary = boardGetCell( shown, cursor.x, cursor.y );
+				pen = boardGlyphCodePoint( shown, cellPattern( primary ) );
+				mvprintw( vp.y + vp.h + 3, 24, "Enter!" );
 			}
 	
-			if( input == 'c' ) {	// Cycle foreground color
-				primary.fg++;
-				if( primary.fg > N_COLORS - 1 ) {
-					primary.fg = 0;
-				}
+			if( input == 'c' || input == 'C' ) {	// Cycle foreground color
+				primary = cellSetFg( primary, cycleColor( cellFg( primary ), input == 'c' ? 1 : -1 ) );
 			}
-			if( input == 'v' ) {	// Cycle background color
-				primary.bg++;
-				if( primary.bg > N_COLORS - 1 ) {
-					primary.bg = 0;
-				}
+			if( input == 'v' || input == 'V' ) {	// Cycle background color
+				primary = cellSetBg( primary, cycleColor( cellBg( primary ), input == 'v' ? 1 : -1 ) );
 			}
 			if( input == 'D' ) {
-				primary.bright = !primary.bright;
+				primary = cellSetBright( primary, !cellBright( primary ) );
 			}
 			if( input == 'F' ) {
-				primary.blink = !primary.blink;
+				primary = cellSetBlink( primary, !cellBlink( primary ) );
 			}
 
 			if( input == '-' ) {
@@ -209,30 +496,19 @@ int main( int argc, char * argv[] ) {
 			}
 
 			if( input == ' ' ) {
-				boardPutCell( my_board, primary, cursor.x, cursor.y );
+				boardPutCell( my_board, penCell( my_board, primary, pen ), cursor.x, cursor.y );
 			}
 			if( input == KEY_DC ) {
-				Cell empty;
-				empty.pattern = ' ';
-				empty.fg = COLOR_WHITE;
-				empty.bg = COLOR_BLACK;
-				empty.bright = true;
-				empty.blink = false;
+				Cell empty = layer > 0 ? CELL_TRANSPARENT : cellMake( ' ', COLOR_WHITE, COLOR_BLACK, true, false );
 				//boardPut( my_board, ' ', cursor.x, cursor.y );
 				boardPutCell( my_board, empty, cursor.x, cursor.y );
 			}
 
 			if( input == '[' ) {
-				primary.pattern--;
-				if( primary.pattern < 32 ) {
-					primary.pattern = 126;
-				}
+				pen = penStep( pen, -1 );
 			}
 			if( input == ']' ) {
-				primary.pattern++;
-				if( primary.pattern > 126 ) {
-					primary.pattern = 32;
-				}
+				pen = penStep( pen, 1 );
 			}
 
 			if( input == KEY_LEFT ) {
@@ -264,67 +540,296 @@ int main( int argc, char * argv[] ) {
 				}
 			}
 			if( input == 'S' ) {
-				boardSaveToFile( my_board, user_input );
+				if( anim->n_frames > 1 ) {
+					// Animations are saved in the foreground, all frames at once.
+					keepOffBrd( user_input, ".bra" );
+					strcpy( doc_name, user_input );
+					PROF_BEGIN( t_save );
+					animSave( anim, user_input );
+					PROF_END( t_save, PROF_SAVE );
+				}
+				else if( layers->n > 1 ) {
+					// So are layered boards.
+					keepOffBrd( user_input, ".brl" );
+					strcpy( doc_name, user_input );
+					PROF_BEGIN( t_save );
+					layerStackSave( layers, user_input );
+					PROF_END( t_save, PROF_SAVE );
+				}
+				else {
+					autosaveRequest( &autosave, my_board, user_input );
+				}
 			}
 			if( input == 'L' ) {
-				Board * try_load = boardLoadFromFile( user_input );
+				PROF_BEGIN( t_load );
+				bool layered = layerFileCheck( user_input );
+				LayerStack * loaded_layers = layered ? layerStackLoad( user_input ) : NULL;
+				Anim * loaded = NULL;
+				if( loaded_layers ) {
+					loaded = animInit( loaded_layers->layers[0].board );
+				}
+				else if( !layered ) {
+					loaded = animLoad( user_input );
+				}
+				PROF_END( t_load, PROF_LOAD );
+				Board * try_load = NULL;
+				if( loaded_layers && loaded ) {
+					// The animation owns the base from here on.
+					loaded_layers->base_owned = false;
+				}
+				else if( loaded && loaded->n_frames > 1 ) {
+					loaded_layers = layerStackInit( loaded->frames[0] );
+				}
+				if( !loaded || ( loaded->n_frames > 1 && !loaded_layers ) ) {
+					errLog( "Couldn't load %s into a Board structure.", user_input );
+					layerStackFree( loaded_layers );
+					animFree( loaded );
+				}
+				else if( loaded_layers ) {
+					// An animation or a layered board replaces the whole document.
+					my_board = editBoard( loaded->frames[0], journal );
+					layerStackFree( layers );
+					animFree( anim );
+					anim = loaded;
+					layers = loaded_layers;
+					frame = 0;
+					layer = 0;
+					full_redraw = true;
+					fitToBoard( my_board, &vp, &cursor, STATUS_LINES + 1 );
+				}
+				else {
+					// A single board replaces the current frame.
+					try_load = animRemoveFrame( loaded, 0 );
+					animFree( loaded );
+					if( ( anim->n_frames > 1 || layers->n > 1 ) && ( try_load->w != my_board->w || try_load->h != my_board->h ) ) {
+						errLog( "%s is %dx%d, but the document's frames and layers are %dx%d.", user_input, try_load->w, try_load->h, my_board->w, my_board->h );
+						boardFree( try_load );
+						try_load = NULL;
+					}
+				}
 				if( try_load ) {
-					boardFree( my_board );
+					// The journal keeps the old board so the load can be undone.
+					if( !journal || !undoRecordSwap( journal, my_board, try_load ) ) {
+						boardFree( my_board );
+					}
 					my_board = NULL;
 					my_board = try_load;
+					full_redraw = true;
+					fitToBoard( my_board, &vp, &cursor, STATUS_LINES + 1 );
+				}
+			}
+
+			// Frames: step back / forward, add a copy of this frame after it,
+			// delete this frame, shorten / lengthen its delay, preview.
+			if( input == '<' || input == '>' ) {
+				int to = frame + ( input == '<' ? -1 : 1 );
+				if( to >= 0 && to < anim->n_frames ) {
+					frame = to;
+					my_board = editBoard( anim->frames[frame], journal );
+					boardMarkAllDirty( my_board );
+				}
+			}
+			if( input == 'N' && layers->n > 1 ) {
+				errLog( "Can't add frames to a board with layers." );
+			}
+			else if( input == 'N' ) {
+				Board * copy = boardMakeFromSelection( my_board, 0, 0, my_board->w, my_board->h );
+				if( copy && animInsertFrame( anim, frame + 1, copy, anim->delays[frame] ) ) {
+					frame++;
+					my_board = editBoard( anim->frames[frame], journal );
 				}
 				else {
-					errLog( "Couldn't load %s into a Board structure.", user_input );
+					boardFree( copy );
+				}
+			}
+			if( input == 'K' && anim->n_frames > 1 ) {
+				Board * gone = animRemoveFrame( anim, frame );
+				if( frame == anim->n_frames ) {
+					frame--;
+				}
+				my_board = editBoard( anim->frames[frame], journal );
+				boardFree( gone );
+				boardMarkAllDirty( my_board );
+			}
+			if( input == '(' && anim->delays[frame] > 10 ) {
+				anim->delays[frame] -= 10;
+			}
+			if( input == ')' && anim->delays[frame] < ANIM_MAX_DELAY ) {
+				anim->delays[frame] += 10;
+			}
+			if( input == 'A' && anim->n_frames > 1 ) {
+				play_clip = animCompile( anim );
+				player = play_clip ? animPlayerInit( play_clip, 0 ) : NULL;
+				if( !player ) {
+					animClipFree( play_clip );
+					play_clip = NULL;
+				}
+			}
+
+			// Layers: select the one below / above, add one above this one,
+			// delete this one, hide / show it, move it down / up.
+			if( ( input == '{' && layer > 0 ) || ( input == '}' && layer < layers->n - 1 ) ) {
+				layer += input == '{' ? -1 : 1;
+				my_board = editBoard( layers->layers[layer].board, journal );
+			}
+			if( input == 'n' && anim->n_frames > 1 ) {
+				errLog( "Can't add layers to an animation." );
+			}
+			else if( input == 'n' && layerStackAdd( layers, layer + 1 ) ) {
+				layer++;
+				my_board = editBoard( layers->layers[layer].board, journal );
+			}
+			if( input == 'k' && layer > 0 ) {
+				// Move the journal off the layer before freeing it.
+				layer--;
+				my_board = editBoard( layers->layers[layer].board, journal );
+				layerStackRemove( layers, layer + 1 );
+			}
+			if( input == 'h' ) {
+				layerStackSetVisible( layers, layer, !layers->layers[layer].visible );
+			}
+			if( ( input == 'm' || input == 'M' ) && layerStackMove( layers, layer, layer + ( input == 'm' ? -1 : 1 ) ) ) {
+				layer += input == 'm' ? -1 : 1;
+			}
+
+			if( ( input == 'u' || input == 'U' ) && journal ) {	// Undo / redo
+				Board * live = ( input == 'u' ) ? undoUndo( journal ) : undoRedo( journal );
+				if( live != my_board ) {
+					my_board = live;
+					full_redraw = true;
+					fitToBoard( my_board, &vp, &cursor, STATUS_LINES + 1 );
 				}
 			}
 			
 			if( doodle_mode ) {
-				boardPutCell( my_board, primary, cursor.x, cursor.y );
+				boardPutCell( my_board, penCell( my_board, primary, pen ), cursor.x, cursor.y );
 			}
 		}
-		clear();
-		boardDraw( my_board, offset, true );
+		// Loads and undo can swap the live board; keep the frame and layer
+		// lists current.
+		if( layer == 0 ) {
+			anim->frames[frame] = my_board;
+		}
+		layers->layers[layer].board = my_board;
+		layers->layers[0].board = anim->frames[frame];
+		if( my_board->w != layers->w || my_board->h != layers->h ) {
+			layers = resetLayers( layers, my_board );
+		}
+		undoCoalesce( journal, doodle_mode || typewriter_mode );
+		undoEndStep( journal );
+		autosaveTick( &autosave, my_board, doc_name );
+		PROF_END( t_input, PROF_INPUT );
+		traceKeyHandled( &trace );
+
+		// Replays draw after every key, so each one gets a render time.
+		first_tick = false;
+		if( !keep_go || ( !trace.replay && !framePacerDue( &pacer ) ) ) {
+			continue;
+		}
+
+		// Only repaint what changed. A full clear is needed when the board is
+		// replaced or the terminal resized, since the old border may be a
+		// different size, and the viewport is repainted when the camera moves.
+		PROF_BEGIN( t_draw );
+		Board * shown = player ? player->board : layerStackComposite( layers );
+		if( viewportFollow( &vp, cursor.x, cursor.y, shown->w, shown->h ) && !full_redraw ) {
+			boardDrawViewport( shown, &vp, false );
+		}
+		if( full_redraw ) {
+			clear();
+			boardDrawViewport( shown, &vp, true );
+			full_redraw = false;
+		}
+		else {
+			boardDrawDirty( shown, &vp );
+		}
+		PROF_END( t_draw, PROF_DRAW );
+		profCount( PROF_FRAMES, 1 );
+		int status_y = vp.y + vp.h + 1;
 	
 		if( !doodle_mode ) {
 			curs_set( 1 ); // Hmm, this doesn't seem to show a different cursor under my current gnome-terminal.
-			mvprintw( 22, 0, "                                          " );
+			move( status_y, 0 );
+			clrtoeol();
 		}
 		else {
 			curs_set( 2 );
-			mvprintw( 22, 0,"Doodle Mode Engaged - TAB to stop" );
+			mvprintw( status_y, 0,"Doodle Mode Engaged - TAB to stop" );
+			clrtoeol();
 		}
 		if( typewriter_mode ) {
-			mvprintw( 22, 0, "Typewriter Mode Engaged - ENTER to stop" );
+			mvprintw( status_y, 0, "Typewriter Mode Engaged - ENTER to stop" );
+			clrtoeol();
 		}
 
-		mvprintw( 23, 0, "X %d Y %d W %d H %d XStep %d YStep %d fg %d bg %d bright %d blink %d\npattern %d / %c clip_z %d %d clip_x %d %d", 
-		cursor.x, cursor.y, my_board->w, my_board->h, cstep_x, cstep_y, primary.fg, primary.bg, primary.bright, primary.blink, primary.pattern, primary.pattern, clip_z.x, clip_z.y, clip_x.x, clip_x.y );
+		// Narrow curses can't print the pen's glyph by itself; the board
+		// shows its ACS look-alike.
+		char pen_glyph[5] = "?";
+		if( pen < GLYPH_ASCII_END || DRAW_WIDE ) {
+			pen_glyph[ glyphToUtf8( pen, pen_glyph ) ] = '\0';
+		}
+		mvprintw( status_y + 1, 0, "X %d Y %d W %d H %d XStep %d YStep %d fg %d bg %d bright %d blink %d\npattern U+%04X %s clip_z %d %d clip_x %d %d frame %d/%d %dms layer %d/%d%s clip %d/%d", 
+		cursor.x, cursor.y, my_board->w, my_board->h, cstep_x, cstep_y, cellFg( primary ), cellBg( primary ), cellBright( primary ), cellBlink( primary ), (unsigned)pen, pen_glyph, clip_z.x, clip_z.y, clip_x.x, clip_x.y, frame + 1, anim->n_frames, anim->delays[frame], layer + 1, layers->n, layers->layers[layer].visible ? "" : " (hidden)", clipboard.n ? clipboard.current + 1 : 0, clipboard.n );
+		clrtoeol();
 
+		move( status_y + 3, 0 );
+		clrtoeol();
 		if( enter_input ) {
-			mvprintw( 25, 0, user_input );
+			mvprintw( status_y + 3, 0, user_input );
+		}
+		else if( show_profile ) {
+			char overlay[160];
+			profFormatOverlay( overlay, sizeof(overlay) );
+			colorSet( COLOR_WHITE, COLOR_BLACK, 0, 0 );
+			mvaddnstr( status_y + 3, 0, overlay, COLS );
 		}
 		
 		curs_set( 1 );
 		if( enter_input ) {
-			move( 25, 0 + user_input_spot );
+			move( status_y + 3, 0 + user_input_spot );
 		}
 		else {
-			move( cursor.y + offset.y, cursor.x + offset.x );
+			move( vp.y + cursor.y - vp.cam_y, vp.x + cursor.x - vp.cam_x );
 		}
+		PROF_BEGIN( t_refresh );
 		refresh();
-		first_tick = false;
+		PROF_END( t_refresh, PROF_REFRESH );
+		traceKeyShown( &trace );
 	}
 
 	/* Shutdown */
-	if( my_board ) {
-		boardFree( my_board );
-		my_board = NULL;
+	autosaveShutdown( &autosave );
+	if( profile_file ) {
+		profDump( profile_file );
 	}
+	uint64_t checksum = boardChecksum( layerStackComposite( layers ) );
+	undoFree( journal );
+	journal = NULL;
+	animPlayerFree( player );
+	animClipFree( play_clip );
+	layerStackFree( layers );
+	animFree( anim );
+	clipFree( &clipboard );
+	my_board = NULL;
 
 	/* Close error handler */
     errLog("    **  Shutting down.  **\n");
     errorHandlerShutdown( &error_handler );
 	
 	endwin();
-	return 0;
+	pairCacheFree( &pair_cache );
+
+	int status = 0;
+	if( trace.replay ) {
+		traceReport( &trace, stdout, checksum );
+		if( expect_checksum && strtoull( expect_checksum, NULL, 16 ) != checksum ) {
+			fprintf( stderr, "%s: checksum %016llx, expected %s\n", replay_file, (unsigned long long)checksum, expect_checksum );
+			status = 1;
+		}
+	}
+	else if( record_file ) {
+		printf( "recorded %s, checksum %016llx\n", record_file, (unsigned long long)checksum );
+	}
+	traceClose( &trace );
+	return status;
 }
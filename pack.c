@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "byte_order.h"
+
+static const unsigned char * entryAt( const Pack * pack, uint32_t i ) {
+	return pack->index + (size_t)i * PACK_ENTRY_SIZE;
+}
+
+// Check the index once at open, so lookups can trust it.
+static bool checkIndex( Pack * pack, uint32_t names_size ) {
+	uint32_t i;
+	if( pack->count > 0 && ( names_size == 0 || pack->names[names_size - 1] != '\0' ) ) {
+		errLog( "packOpen(): %s has a bad name table", pack->filename );
+		return false;
+	}
+	for( i = 0; i < pack->count; i++ ) {
+		const unsigned char * e = entryAt( pack, i );
+		uint32_t name_off = getU32LE( e );
+		uint32_t name_len = getU32LE( e + 4 );
+		uint64_t off = getU64LE( e + 8 );
+		uint64_t size = getU64LE( e + 16 );
+		if( (uint64_t)name_off + name_len >= names_size || pack->names[name_off + name_len] != '\0' ) {
+			errLog( "packOpen(): %s: entry %u has a bad name", pack->filename, i );
+			return false;
+		}
+		if( off > pack->size || size > pack->size - off ) {
+			errLog( "packOpen(): %s: entry %u is out of bounds", pack->filename, i );
+			return false;
+		}
+		if( i > 0 && strcmp( packName( pack, i - 1 ), pack->names + name_off ) >= 0 ) {
+			errLog( "packOpen(): %s: index is not sorted", pack->filename );
+			return false;
+		}
+	}
+	return true;
+}
+
+/*  Map a pack. Only the header and index are read; boards are not touched
+    until asked for. Returns NULL on error.                               */
+Pack * packOpen( const char * filename ) {
+	FileMap fm;
+	if( !fileMapOpen( &fm, filename ) ) {
+		errLog( "packOpen(): Could not load %s", filename );
+		return NULL;
+	}
+	if( fm.size < PACK_HEADER_SIZE || memcmp( fm.data, PACK_MAGIC, PACK_MAGIC_LEN ) != 0 ) {
+		errLog( "packOpen(): %s is not a pack", filename );
+		fileMapClose( &fm );
+		return NULL;
+	}
+	unsigned int version = getU16LE( fm.data + 4 );
+	uint32_t count = getU32LE( fm.data + 8 );
+	uint32_t names_size = getU32LE( fm.data + 12 );
+	if( version != PACK_VERSION ) {
+		errLog( "packOpen(): %s has unsupported version %u", filename, version );
+		fileMapClose( &fm );
+		return NULL;
+	}
+	if( PACK_HEADER_SIZE + (uint64_t)count * PACK_ENTRY_SIZE + names_size > fm.size ) {
+		errLog( "packOpen(): %s is truncated", filename );
+		fileMapClose( &fm );
+		return NULL;
+	}
+
+	Pack * pack = malloc( sizeof(Pack) );
+	char * name_copy = malloc( strlen( filename ) + 1 );
+	CellShare * share = ( pack && name_copy ) ? cellShareFromMap( &fm ) : NULL;
+	if( !share ) {
+		errLog( "packOpen(): malloc() failed on %s", filename );
+		free( pack );
+		free( name_copy );
+		fileMapClose( &fm );
+		return NULL;
+	}
+	strcpy( name_copy, filename );
+	pack->share = share;
+	pack->data = fm.data;
+	pack->size = fm.size;
+	pack->count = count;
+	pack->index = fm.data + PACK_HEADER_SIZE;
+	pack->names = (const char *)pack->index + (size_t)count * PACK_ENTRY_SIZE;
+	pack->filename = name_copy;
+	if( !checkIndex( pack, names_size ) ) {
+		packClose( pack );
+		return NULL;
+	}
+	return pack;
+}
+
+// Views taken from the pack keep the mapping alive until they are freed.
+void packClose( Pack * pack ) {
+	if( pack ) {
+		cellShareRelease( pack->share );
+		free( pack->filename );
+		free( pack );
+	}
+}
+
+int packCount( const Pack * pack ) {
+	return (int)pack->count;
+}
+
+const char * packName( const Pack * pack, int i ) {
+	return pack->names + getU32LE( entryAt( pack, i ) );
+}
+
+// Index of the board called name, or -1. Binary search over the index.
+int packFind( const Pack * pack, const char * name ) {
+	size_t len = strlen( name );
+	uint32_t lo = 0, hi = pack->count;
+	while( lo < hi ) {
+		uint32_t mid = lo + ( hi - lo ) / 2;
+		const unsigned char * e = entryAt( pack, mid );
+		uint32_t mid_len = getU32LE( e + 4 );
+		int cmp = memcmp( name, pack->names + getU32LE( e ), len < mid_len ? len : mid_len );
+		if( cmp == 0 ) {
+			if( len == mid_len ) {
+				return (int)mid;
+			}
+			cmp = len < mid_len ? -1 : 1;
+		}
+		if( cmp < 0 ) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+// The i'th board, as a copy-on-write view into the mapping. Free it with
+// boardFree() as usual.
+Board * packBoardAt( Pack * pack, int i ) {
+	if( i < 0 || (uint32_t)i >= pack->count ) {
+		errLog( "packBoardAt(): no entry %d in %s", i, pack->filename );
+		return NULL;
+	}
+	const unsigned char * e = entryAt( pack, i );
+	char name[FILENAME_MAX];
+	snprintf( name, sizeof(name), "%s:%s", pack->filename, packName( pack, i ) );
+	return boardViewFromBinary( pack->data + getU64LE( e + 8 ), getU64LE( e + 16 ), pack->share, name );
+}
+
+Board * packGetBoard( Pack * pack, const char * name ) {
+	int i = packFind( pack, name );
+	if( i < 0 ) {
+		errLog( "packGetBoard(): %s not found in %s", name, pack->filename );
+		return NULL;
+	}
+	return packBoardAt( pack, i );
+}
+
+typedef struct PackItem_t {
+	char * name;
+	Board * board;
+} PackItem;
+
+static int compareItems( const void * a, const void * b ) {
+	return strcmp( ( (const PackItem *)a )->name, ( (const PackItem *)b )->name );
+}
+
+static bool writePadding( FILE * f, uint64_t * pos ) {
+	static const unsigned char zeros[PACK_ALIGN];
+	size_t pad = ( PACK_ALIGN - *pos % PACK_ALIGN ) % PACK_ALIGN;
+	*pos += pad;
+	return fwrite( zeros, 1, pad, f ) == pad;
+}
+
+/*  Write n boards as a pack, under the given names (unique, any order).
+    Like board saves, it goes through saveOpen() / saveClose().           */
+bool packWrite( const char * filename, char ** names, Board ** boards, int n ) {
+	PackItem * items = malloc( ( n > 0 ? n : 1 ) * sizeof(PackItem) );
+	unsigned char * head = NULL;
+	FILE * f = NULL;
+	char tmp_name[FILENAME_MAX];
+	bool ok = false;
+	int i;
+	if( !items ) {
+		errLog( "packWrite(): malloc() failed on %d items", n );
+		return false;
+	}
+	uint64_t names_size = 0;
+	for( i = 0; i < n; i++ ) {
+		items[i].name = names[i];
+		items[i].board = boards[i];
+		names_size += strlen( names[i] ) + 1;
+	}
+	qsort( items, n, sizeof(PackItem), compareItems );
+	for( i = 1; i < n; i++ ) {
+		if( strcmp( items[i - 1].name, items[i].name ) == 0 ) {
+			errLog( "packWrite(): duplicate name %s", items[i].name );
+			goto done;
+		}
+	}
+	if( names_size > UINT32_MAX ) {
+		errLog( "packWrite(): name table too large" );
+		goto done;
+	}
+
+	// Header, index and names are built in one buffer; payloads follow.
+	size_t head_len = PACK_HEADER_SIZE + (size_t)n * PACK_ENTRY_SIZE + names_size;
+	head = calloc( 1, head_len );
+	if( !head ) {
+		errLog( "packWrite(): malloc() failed on %zu byte index", head_len );
+		goto done;
+	}
+	memcpy( head, PACK_MAGIC, PACK_MAGIC_LEN );
+	putU16LE( head + 4, PACK_VERSION );
+	putU32LE( head + 8, n );
+	putU32LE( head + 12, (uint32_t)names_size );
+	unsigned char * e = head + PACK_HEADER_SIZE;
+	char * name_out = (char *)e + (size_t)n * PACK_ENTRY_SIZE;
+	uint32_t name_off = 0;
+	uint64_t off = head_len;
+	for( i = 0; i < n; i++, e += PACK_ENTRY_SIZE ) {
+		Board * b = items[i].board;
+		size_t len = strlen( items[i].name );
+		uint64_t size = boardBinarySize( b );
+		off += ( PACK_ALIGN - off % PACK_ALIGN ) % PACK_ALIGN;
+		putU32LE( e, name_off );
+		putU32LE( e + 4, len );
+		putU64LE( e + 8, off );
+		putU64LE( e + 16, size );
+		memcpy( name_out + name_off, items[i].name, len + 1 );
+		name_off += len + 1;
+		off += size;
+	}
+
+	f = saveOpen( filename, tmp_name, sizeof(tmp_name), "wb" );
+	if( !f ) {
+		goto done;
+	}
+	uint64_t pos = head_len;
+	ok = fwrite( head, 1, head_len, f ) == head_len;
+	for( i = 0; i < n && ok; i++ ) {
+		Board * b = items[i].board;
+		ok = writePadding( f, &pos ) && boardWriteBinary( b, f );
+		pos += boardBinarySize( b );
+	}
+	ok = saveClose( f, tmp_name, filename, ok );
+
+done:
+	free( head );
+	free( items );
+	return ok;
+}
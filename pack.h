@@ -0,0 +1,55 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "board.h"
+
+/*  Asset packs: many boards in one file, mapped once and looked up by name.
+
+    .brp layout. All integers are little-endian.
+      0  char[4]   magic "BRDP"
+      4  u16       version (PACK_VERSION)
+      6  u16       reserved, 0
+      8  u32       number of entries n
+     12  u32       size of the name table in bytes
+     16  entry[n]  index, sorted bytewise by name, PACK_ENTRY_SIZE each:
+                     u32 name offset into the name table
+                     u32 name length, not counting the NUL
+                     u64 payload offset from the start of the file
+                     u64 payload size
+     ..  name table: the names, each NUL-terminated
+     ..  payloads: complete binary .brd v2 files, each starting on a
+                   PACK_ALIGN boundary so their cells can be used in place.
+
+    Boards taken from a pack are views into the mapping (see
+    boardViewFromBinary()): reading them costs no parsing or copying, and
+    they may outlive the pack.                                            */
+#define PACK_MAGIC "BRDP"
+#define PACK_MAGIC_LEN 4
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 16
+#define PACK_ENTRY_SIZE 24
+#define PACK_ALIGN 16
+
+typedef struct Pack_t {
+	CellShare * share;              // Owns the mapping; shared with every view.
+	const unsigned char * data;
+	size_t size;
+	uint32_t count;
+	const unsigned char * index;
+	const char * names;
+	char * filename;
+} Pack;
+
+Pack * packOpen( const char * filename );
+void packClose( Pack * pack );
+int packCount( const Pack * pack );
+const char * packName( const Pack * pack, int i );
+int packFind( const Pack * pack, const char * name );
+Board * packBoardAt( Pack * pack, int i );
+Board * packGetBoard( Pack * pack, const char * name );
+bool packWrite( const char * filename, char ** names, Board ** boards, int n );
+
+#endif // PACK_H
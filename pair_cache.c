@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pair_cache.h"
+#include "profile.h"
+
+#define PAIR_KEYS ( PALETTE_SIZE * PALETTE_SIZE )
+
+PairCache pair_cache;
+
+/*  Size the cache for a terminal with n_colors colors and n_pairs pairs
+    (COLORS and COLOR_PAIRS). Returns false if it can't be allocated;
+    every extended combination then falls back to pair 0.               */
+bool pairCacheInit( PairCache * pc, int n_colors, int n_pairs ) {
+	int i;
+	memset( pc, 0, sizeof(PairCache) );
+	pc->head = -1;
+	pc->tail = -1;
+	pc->n_colors = n_colors < PALETTE_SIZE ? n_colors : PALETTE_SIZE;
+	for( i = 0; i < PALETTE_SIZE; i++ ) {
+		pc->reduce[i] = pc->n_colors > 0 ? paletteReduce( i, pc->n_colors ) : 0;
+	}
+	int max_pair = n_pairs - 1;
+	if( !PAIR_EXTENDED && max_pair > PAIR_CHTYPE_MAX ) {
+		max_pair = PAIR_CHTYPE_MAX;
+	}
+	if( max_pair <= PAIR_FIXED ) {
+		return true;
+	}
+	int n = max_pair - PAIR_FIXED;
+	if( n > PAIR_KEYS ) {
+		n = PAIR_KEYS;
+	}
+	pc->key = malloc( n * sizeof(int) );
+	pc->prev = malloc( n * sizeof(int) );
+	pc->next = malloc( n * sizeof(int) );
+	pc->slot_of = calloc( PAIR_KEYS, sizeof(uint32_t) );
+	if( !pc->key || !pc->prev || !pc->next || !pc->slot_of ) {
+		errLog( "pairCacheInit(): malloc() failed on %d pairs", n );
+		pairCacheFree( pc );
+		return false;
+	}
+	pc->n_slots = n;
+	return true;
+}
+
+void pairCacheFree( PairCache * pc ) {
+	free( pc->key );
+	free( pc->prev );
+	free( pc->next );
+	free( pc->slot_of );
+	pc->key = pc->prev = pc->next = NULL;
+	pc->slot_of = NULL;
+	pc->n_slots = 0;
+	pc->used = 0;
+	pc->head = pc->tail = -1;
+}
+
+static void lruUnlink( PairCache * pc, int s ) {
+	if( pc->prev[s] >= 0 ) {
+		pc->next[ pc->prev[s] ] = pc->next[s];
+	}
+	else {
+		pc->head = pc->next[s];
+	}
+	if( pc->next[s] >= 0 ) {
+		pc->prev[ pc->next[s] ] = pc->prev[s];
+	}
+	else {
+		pc->tail = pc->prev[s];
+	}
+}
+
+static void lruPushFront( PairCache * pc, int s ) {
+	pc->prev[s] = -1;
+	pc->next[s] = pc->head;
+	if( pc->head >= 0 ) {
+		pc->prev[ pc->head ] = s;
+	}
+	pc->head = s;
+	if( pc->tail < 0 ) {
+		pc->tail = s;
+	}
+}
+
+static int definePair( int pair, int fg, int bg ) {
+#if PAIR_EXTENDED
+	return init_extended_pair( pair, fg, bg );
+#else
+	return init_pair( pair, fg, bg );
+#endif
+}
+
+// Pair number for fg on bg, defining it if it has none. Colors beyond the
+// terminal's are first reduced to the nearest it has.
+int pairCacheGet( PairCache * pc, int fg, int bg ) {
+	fg = pc->reduce[ fg & ( PALETTE_SIZE - 1 ) ];
+	bg = pc->reduce[ bg & ( PALETTE_SIZE - 1 ) ];
+	if( fg < N_COLORS && bg < N_COLORS ) {
+		return col_map[fg][bg];
+	}
+	if( pc->n_slots == 0 ) {
+		return MONOCHROME;
+	}
+	int key = fg | bg << 8;
+	int s = (int)pc->slot_of[key] - 1;
+	if( s >= 0 ) {
+		if( s != pc->head ) {
+			lruUnlink( pc, s );
+			lruPushFront( pc, s );
+		}
+		return PAIR_FIXED + 1 + s;
+	}
+
+	if( pc->used < pc->n_slots ) {
+		s = pc->used++;
+	}
+	else {
+		s = pc->tail;
+		lruUnlink( pc, s );
+		if( pc->key[s] >= 0 ) {
+			pc->slot_of[ pc->key[s] ] = 0;
+		}
+		pc->evictions++;
+		profCount( PROF_PAIR_EVICTIONS, 1 );
+	}
+	lruPushFront( pc, s );
+	profCount( PROF_PAIR_DEFINES, 1 );
+	if( definePair( PAIR_FIXED + 1 + s, fg, bg ) == ERR ) {
+		errLogLimited( LOG_WARN, "pairCacheGet(): could not define pair %d as fg %d bg %d", PAIR_FIXED + 1 + s, fg, bg );
+		pc->key[s] = -1;
+		return MONOCHROME;
+	}
+	pc->key[s] = key;
+	pc->slot_of[key] = s + 1;
+	return PAIR_FIXED + 1 + s;
+}
@@ -0,0 +1,56 @@
+#ifndef PAIR_CACHE_H
+#define PAIR_CACHE_H
+
+#include <stdint.h>
+
+#include "curses.h"
+
+#include "curses_wrapper.h"
+#include "draw.h"
+#include "palette.h"
+
+/*  Curses color pairs for the full palette. The 8x8 classic combinations
+    keep their fixed pairs in col_map; every other (fg, bg) gets a pair on
+    first use, from a pool managed least-recently-used. A lookup is one
+    array index and an O(1) list move, so rendering cost doesn't depend on
+    how many combinations a board uses. When the pool is full the least
+    recently drawn combination's pair is redefined, which recolors any cell
+    still on screen with it, so the pool is as large as the terminal allows.
+    Each such redefinition bumps evictions; boardDrawDirty() repaints the
+    whole viewport when it sees one, since cells outside the dirty spans
+    may now show the wrong colors.
+
+    Pair numbers in a chtype are limited to PAIR_CHTYPE_MAX. Wide ncurses
+    with extended colors (init_extended_pair) can go beyond, up to
+    COLOR_PAIRS; those pairs are drawn through cchar_t.                  */
+#define PAIR_FIXED ( N_COLORS * N_COLORS )  // Pairs 1..64: col_map.
+#define PAIR_CHTYPE_MAX 255
+
+#if DRAW_WIDE && defined(NCURSES_EXT_COLORS)
+#define PAIR_EXTENDED 1
+#else
+#define PAIR_EXTENDED 0
+#endif
+
+typedef struct PairCache_t {
+	int n_colors;           // Colors the terminal shows, at most PALETTE_SIZE.
+	int n_slots;            // Pairs PAIR_FIXED + 1 .. PAIR_FIXED + n_slots.
+	int used;               // Slots handed out so far.
+	int * key;              // Per slot: fg | bg << 8, or -1.
+	int * prev;             // LRU list links per slot, -1 at the ends.
+	int * next;
+	int head;               // Most recently used slot.
+	int tail;               // Next to be evicted.
+	uint32_t * slot_of;     // Per (fg, bg) key: slot + 1, 0 if it has none.
+	uint8_t reduce[PALETTE_SIZE];   // Palette color -> one the terminal has.
+	unsigned long evictions;        // Pairs redefined so far.
+} PairCache;
+
+// The cache colPair() uses. Set up by init_curses().
+extern PairCache pair_cache;
+
+bool pairCacheInit( PairCache * pc, int n_colors, int n_pairs );
+void pairCacheFree( PairCache * pc );
+int pairCacheGet( PairCache * pc, int fg, int bg );
+
+#endif // PAIR_CACHE_H
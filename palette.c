@@ -0,0 +1,73 @@
+#include "palette.h"
+
+// The first sixteen, as the VGA text mode draws them.
+static const uint8_t basic_rgb[16][3] = {
+	{ 0x00, 0x00, 0x00 }, { 0xaa, 0x00, 0x00 }, { 0x00, 0xaa, 0x00 }, { 0xaa, 0x55, 0x00 },
+	{ 0x00, 0x00, 0xaa }, { 0xaa, 0x00, 0xaa }, { 0x00, 0xaa, 0xaa }, { 0xaa, 0xaa, 0xaa },
+	{ 0x55, 0x55, 0x55 }, { 0xff, 0x55, 0x55 }, { 0x55, 0xff, 0x55 }, { 0xff, 0xff, 0x55 },
+	{ 0x55, 0x55, 0xff }, { 0xff, 0x55, 0xff }, { 0x55, 0xff, 0xff }, { 0xff, 0xff, 0xff },
+};
+
+// Channel levels of the color cube.
+static const uint8_t cube_levels[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+
+void paletteRgb( int color, int * r, int * g, int * b ) {
+	color &= PALETTE_SIZE - 1;
+	if( color < PALETTE_CUBE_FIRST ) {
+		*r = basic_rgb[color][0];
+		*g = basic_rgb[color][1];
+		*b = basic_rgb[color][2];
+	}
+	else if( color < PALETTE_GRAY_FIRST ) {
+		color -= PALETTE_CUBE_FIRST;
+		*r = cube_levels[color / 36];
+		*g = cube_levels[( color / 6 ) % 6];
+		*b = cube_levels[color % 6];
+	}
+	else {
+		*r = *g = *b = 8 + ( color - PALETTE_GRAY_FIRST ) * 10;
+	}
+}
+
+static int distance( int color, int r, int g, int b ) {
+	int pr, pg, pb;
+	paletteRgb( color, &pr, &pg, &pb );
+	return ( pr - r ) * ( pr - r ) + ( pg - g ) * ( pg - g ) + ( pb - b ) * ( pb - b );
+}
+
+// Nearest cube step for a channel value.
+static int cubeStep( int v ) {
+	int i;
+	for( i = 0; i < 5 && v > ( cube_levels[i] + cube_levels[i + 1] ) / 2; i++ );
+	return i;
+}
+
+// Nearest palette entry for an RGB color, from the cube or the gray ramp
+// (the sixteen basic colors vary too much between terminals to aim for).
+int paletteFromRgb( int r, int g, int b ) {
+	int cube = PALETTE_CUBE_FIRST + cubeStep( r ) * 36 + cubeStep( g ) * 6 + cubeStep( b );
+	int level = ( r + g + b ) / 3;
+	int gray = level < 8 ? 0 : ( level - 8 + 5 ) / 10;
+	if( gray > 23 ) {
+		gray = 23;
+	}
+	gray += PALETTE_GRAY_FIRST;
+	return distance( gray, r, g, b ) < distance( cube, r, g, b ) ? gray : cube;
+}
+
+// Nearest of the first n_colors entries, for terminals with fewer colors.
+int paletteReduce( int color, int n_colors ) {
+	if( color < n_colors ) {
+		return color;
+	}
+	int r, g, b, i, best = 0, best_d = -1;
+	paletteRgb( color, &r, &g, &b );
+	for( i = 0; i < n_colors && i < PALETTE_CUBE_FIRST; i++ ) {
+		int d = distance( i, r, g, b );
+		if( best_d < 0 || d < best_d ) {
+			best = i;
+			best_d = d;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,19 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+/*  The 256-color palette cells index, as xterm lays it out: 0-7 the classic
+    curses colors, 8-15 their bright versions, 16-231 a 6x6x6 RGB cube and
+    232-255 a gray ramp. Cells keep one byte per color, so RGB colors are
+    stored as their nearest palette entry. No curses needed here, so
+    exporters can use it too.                                            */
+#define PALETTE_SIZE 256
+#define PALETTE_CUBE_FIRST 16
+#define PALETTE_GRAY_FIRST 232
+
+void paletteRgb( int color, int * r, int * g, int * b );
+int paletteFromRgb( int r, int g, int b );
+int paletteReduce( int color, int n_colors );
+
+#endif // PALETTE_H
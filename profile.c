@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+#include "error_handler.h"
+
+Profile profile;
+
+static const char * timer_names[PROF_N_TIMERS] = {
+	"input", "draw", "refresh", "fill", "save", "load", "copy", "paste", "composite"
+};
+
+static const char * counter_names[PROF_N_COUNTERS] = {
+	"curses_calls", "cells_drawn", "frames", "pair_defines", "pair_evictions", "cells_composited",
+	"clip_allocs", "clip_reuses"
+};
+
+const char * profTimerName( int timer ) {
+	return timer_names[timer];
+}
+
+const char * profCounterName( int counter ) {
+	return counter_names[counter];
+}
+
+// Upper edge of a histogram bucket, in ns. Inverse of profBucket().
+static uint64_t bucketLimit( int b ) {
+	if( b < 4 ) {
+		return b + 1;
+	}
+	int msb = b / 4 + 1;
+	return (uint64_t)( 5 + b % 4 ) << ( msb - 2 );
+}
+
+// Duration below which a fraction p (0..1) of the samples fall. Resolution
+// is the bucket width, 25%; the result is kept within min..max.
+uint64_t profPercentile( const ProfTimer * t, double p ) {
+	if( t->count == 0 ) {
+		return 0;
+	}
+	uint64_t want = (uint64_t)( p * t->count );
+	uint64_t seen = 0;
+	int b;
+	for( b = 0; b < PROF_BUCKETS; b++ ) {
+		seen += t->buckets[b];
+		if( seen > want || seen == t->count ) {
+			break;
+		}
+	}
+	uint64_t limit = bucketLimit( b );
+	if( limit > t->max_ns ) {
+		limit = t->max_ns;
+	}
+	return limit > t->min_ns ? limit : t->min_ns;
+}
+
+static double avgUs( const ProfTimer * t ) {
+	return t->count ? t->total_ns / 1000.0 / t->count : 0.0;
+}
+
+/*  One status line: avg/p99 in ms for the per-frame timers, then the
+    counters. Returns the snprintf() result.                              */
+int profFormatOverlay( char * buf, size_t len ) {
+	const ProfTimer * in = &profile.timers[PROF_INPUT];
+	const ProfTimer * dr = &profile.timers[PROF_DRAW];
+	const ProfTimer * rf = &profile.timers[PROF_REFRESH];
+	return snprintf( buf, len, "in %.2f/%.2f draw %.2f/%.2f refresh %.2f/%.2f ms  frames %llu cells %llu calls %llu pairs %llu/%llu",
+		avgUs( in ) / 1000, profPercentile( in, 0.99 ) / 1e6,
+		avgUs( dr ) / 1000, profPercentile( dr, 0.99 ) / 1e6,
+		avgUs( rf ) / 1000, profPercentile( rf, 0.99 ) / 1e6,
+		(unsigned long long)profile.counters[PROF_FRAMES],
+		(unsigned long long)profile.counters[PROF_CELLS_DRAWN],
+		(unsigned long long)profile.counters[PROF_CURSES_CALLS],
+		(unsigned long long)profile.counters[PROF_PAIR_DEFINES],
+		(unsigned long long)profile.counters[PROF_PAIR_EVICTIONS] );
+}
+
+static void dumpCsv( FILE * f ) {
+	int i;
+	fprintf( f, "name,count,min_us,avg_us,p50_us,p99_us,max_us\n" );
+	for( i = 0; i < PROF_N_TIMERS; i++ ) {
+		const ProfTimer * t = &profile.timers[i];
+		fprintf( f, "%s,%llu,%.1f,%.1f,%.1f,%.1f,%.1f\n", timer_names[i], (unsigned long long)t->count,
+			t->min_ns / 1000.0, avgUs( t ), profPercentile( t, 0.5 ) / 1000.0,
+			profPercentile( t, 0.99 ) / 1000.0, t->max_ns / 1000.0 );
+	}
+	// Counters use the count column only.
+	for( i = 0; i < PROF_N_COUNTERS; i++ ) {
+		fprintf( f, "%s,%llu,,,,,\n", counter_names[i], (unsigned long long)profile.counters[i] );
+	}
+}
+
+static void dumpJson( FILE * f ) {
+	int i;
+	fprintf( f, "{\n  \"timers\": {\n" );
+	for( i = 0; i < PROF_N_TIMERS; i++ ) {
+		const ProfTimer * t = &profile.timers[i];
+		fprintf( f, "    \"%s\": { \"count\": %llu, \"min_us\": %.1f, \"avg_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f }%s\n",
+			timer_names[i], (unsigned long long)t->count, t->min_ns / 1000.0, avgUs( t ),
+			profPercentile( t, 0.5 ) / 1000.0, profPercentile( t, 0.99 ) / 1000.0, t->max_ns / 1000.0,
+			i < PROF_N_TIMERS - 1 ? "," : "" );
+	}
+	fprintf( f, "  },\n  \"counters\": {\n" );
+	for( i = 0; i < PROF_N_COUNTERS; i++ ) {
+		fprintf( f, "    \"%s\": %llu%s\n", counter_names[i], (unsigned long long)profile.counters[i],
+			i < PROF_N_COUNTERS - 1 ? "," : "" );
+	}
+	fprintf( f, "  }\n}\n" );
+}
+
+// Write all timers and counters to filename: JSON if it ends in ".json",
+// CSV otherwise.
+bool profDump( const char * filename ) {
+	FILE * f = fopen( filename, "w" );
+	if( !f ) {
+		errLog( "profDump(): Could not open %s", filename );
+		return false;
+	}
+	size_t n = strlen( filename );
+	if( n >= 5 && strcmp( filename + n - 5, ".json" ) == 0 ) {
+		dumpJson( f );
+	}
+	else {
+		dumpCsv( f );
+	}
+	if( fclose( f ) != 0 ) {
+		errLog( "profDump(): Write failed on %s", filename );
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,114 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*  Lightweight timing and counters for the editor. Timers keep count,
+    min/max/total and a log-scale histogram of nanoseconds (four buckets per
+    power of two) for percentiles. Recording is inline and needs no
+    locking as long as each timer is only recorded from one thread at a
+    time. Anything with a probe links profile.c, which holds the data;
+    build with -DPROFILE_DISABLE to compile all probes out.              */
+
+// -- Timers
+
+#define PROF_INPUT 0        // Handling one key.
+#define PROF_DRAW 1         // Painting the board into curses.
+#define PROF_REFRESH 2      // refresh(): sending the frame to the terminal.
+#define PROF_FILL 3
+#define PROF_SAVE 4
+#define PROF_LOAD 5
+#define PROF_COPY 6
+#define PROF_PASTE 7
+#define PROF_COMPOSITE 8    // Flattening changed layer cells.
+#define PROF_N_TIMERS 9
+
+// -- Counters
+
+#define PROF_CURSES_CALLS 0     // Curses output calls made by the renderer.
+#define PROF_CELLS_DRAWN 1      // Board cells sent to curses.
+#define PROF_FRAMES 2
+#define PROF_PAIR_DEFINES 3     // Color pairs (re)defined by the pair cache.
+#define PROF_PAIR_EVICTIONS 4   // ...of which took over a pair in use.
+#define PROF_CELLS_COMPOSITED 5 // Layer cells recomposited.
+#define PROF_CLIP_ALLOCS 6      // Clipboard copies that needed a new board...
+#define PROF_CLIP_REUSES 7      // ...and that reused a pooled one.
+#define PROF_N_COUNTERS 8
+
+#define PROF_BUCKETS 256
+
+typedef struct ProfTimer_t {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t buckets[PROF_BUCKETS];
+} ProfTimer;
+
+typedef struct Profile_t {
+	ProfTimer timers[PROF_N_TIMERS];
+	uint64_t counters[PROF_N_COUNTERS];
+} Profile;
+
+extern Profile profile;
+
+const char * profTimerName( int timer );
+const char * profCounterName( int counter );
+uint64_t profPercentile( const ProfTimer * t, double p );
+int profFormatOverlay( char * buf, size_t len );
+bool profDump( const char * filename );
+
+#ifndef PROFILE_DISABLE
+
+static inline uint64_t profNow( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Histogram bucket for a duration: exact below 4ns, then four buckets per
+// power of two, so each bucket is at most 25% wide.
+static inline int profBucket( uint64_t ns ) {
+	if( ns < 4 ) {
+		return (int)ns;
+	}
+	int msb = 63 - __builtin_clzll( ns );
+	return ( msb - 1 ) * 4 + (int)( ( ns >> ( msb - 2 ) ) & 3 );
+}
+
+static inline void profRecord( int timer, uint64_t ns ) {
+	ProfTimer * t = &profile.timers[timer];
+	if( t->count == 0 || ns < t->min_ns ) {
+		t->min_ns = ns;
+	}
+	if( ns > t->max_ns ) {
+		t->max_ns = ns;
+	}
+	t->count++;
+	t->total_ns += ns;
+	t->buckets[ profBucket( ns ) ]++;
+}
+
+static inline void profCount( int counter, uint64_t n ) {
+	profile.counters[counter] += n;
+}
+
+// Time a block:  PROF_BEGIN( t ); ...; PROF_END( t, PROF_DRAW );
+#define PROF_BEGIN( var ) uint64_t var = profNow()
+#define PROF_END( var, timer ) profRecord( timer, profNow() - var )
+// ns since PROF_BEGIN( var ), for a duration recorded later (or elsewhere).
+#define PROF_ELAPSED( var ) ( profNow() - var )
+
+#else
+
+#define profRecord( timer, ns ) ( (void)0 )
+#define profCount( counter, n ) ( (void)0 )
+#define PROF_BEGIN( var ) ( (void)0 )
+#define PROF_END( var, timer ) ( (void)0 )
+#define PROF_ELAPSED( var ) ( (uint64_t)0 )
+
+#endif // PROFILE_DISABLE
+
+#endif // PROFILE_H
@@ -0,0 +1,254 @@
+/*  bench: times the board core at a range of sizes, for comparing builds
+    before and after layout or format changes.
+
+    Usage: bench [-s WxH] [-o scratch_file]
+
+    -s limits the run to one size; by default every size in bench_sizes[]
+    is run. Results are tab-separated: operation, size, ns per cell, total
+    milliseconds, and bytes allocated (board footprint or file size).     */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "board_baked.h"
+#include "pack.h"
+
+static const Coord bench_sizes[] = {
+	{ 80, 25 },
+	{ 256, 256 },
+	{ 1024, 1024 },
+	{ 4096, 4096 },
+};
+#define N_BENCH_SIZES ( sizeof(bench_sizes) / sizeof(bench_sizes[0]) )
+
+// Small operations are repeated until roughly this many cells are touched.
+#define BENCH_TARGET_CELLS ( 1 << 24 )
+
+static const char * scratch_file = "bench.tmp.brd";
+
+static double nowNs( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report( const char * op, Board * b, double ns, long reps, size_t bytes ) {
+	double cells = (double)b->w * b->h * reps;
+	printf( "%-18s\t%dx%d\t%8.2f ns/cell\t%10.3f ms\t%zu bytes\n", op, b->w, b->h, ns / cells, ns / 1e6, bytes );
+	fflush( stdout );
+}
+
+static long repsFor( Board * b ) {
+	long cells = (long)b->w * b->h;
+	long reps = BENCH_TARGET_CELLS / cells;
+	return reps < 1 ? 1 : reps;
+}
+
+static size_t fileSize( const char * name ) {
+	struct stat st;
+	return stat( name, &st ) == 0 ? (size_t)st.st_size : 0;
+}
+
+static uint32_t xorshift( uint32_t * s ) {
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+// Serpentine maze: a wall in every other column, with the gap alternating
+// between the top and bottom row. Worst case for a scanline fill.
+static void makeMaze( Board * b ) {
+	Cell wall = cellMake( '#', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	int x, y;
+	boardWipe( b, ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	for( x = 1; x < b->w; x += 2 ) {
+		int gap = ( x / 2 ) % 2 ? 0 : b->h - 1;
+		for( y = 0; y < b->h; y++ ) {
+			if( y != gap ) {
+				boardPutCell( b, wall, x, y );
+			}
+		}
+	}
+}
+
+static void benchSize( int w, int h ) {
+	double t0;
+	long r, reps;
+	Board * b = boardInit( w, h, true );
+	Board * other = boardInit( w, h, true );
+	if( !b || !other ) {
+		fprintf( stderr, "bench: boardInit(%d, %d) failed\n", w, h );
+		exit( 1 );
+	}
+	reps = repsFor( b );
+
+	t0 = nowNs();
+	for( r = 0; r < reps; r++ ) {
+		boardFree( boardInit( w, h, true ) );
+	}
+	report( "boardInit", b, nowNs() - t0, reps, boardMemoryUsage( b ) );
+
+	t0 = nowNs();
+	for( r = 0; r < reps; r++ ) {
+		boardWipe( b, r & 1 ? '.' : ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	}
+	report( "boardWipe", b, nowNs() - t0, reps, 0 );
+
+	// Random access: one get and one put per cell.
+	uint32_t seed = 12345;
+	long i, n = (long)w * h * reps;
+	Cell acc = 0;
+	t0 = nowNs();
+	for( i = 0; i < n; i++ ) {
+		uint32_t v = xorshift( &seed );
+		int x = v % w;
+		int y = ( v >> 16 ) % h;
+		acc ^= boardGetCell( b, x, y );
+		boardPutCell( b, acc, y % w, x % h );
+	}
+	report( "get/put random", b, nowNs() - t0, reps, 0 );
+
+	Cell paint = cellMake( '~', COLOR_BLUE, COLOR_BLACK, 0, 0 );
+	Cell blank = cellMake( ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+	double total = 0;
+	for( r = 0; r < reps; r++ ) {
+		boardWipe( b, ' ', COLOR_WHITE, COLOR_BLACK, 1, 0 );
+		t0 = nowNs();
+		floodFill( b, blank, paint, w / 2, h / 2, 4, NULL );
+		total += nowNs() - t0;
+	}
+	report( "floodFill open", b, total, reps, 0 );
+
+	total = 0;
+	for( r = 0; r < reps; r++ ) {
+		makeMaze( b );
+		t0 = nowNs();
+		floodFill( b, blank, paint, 0, 0, 4, NULL );
+		total += nowNs() - t0;
+	}
+	report( "floodFill maze", b, total, reps, 0 );
+
+	t0 = nowNs();
+	for( r = 0; r < reps; r++ ) {
+		boardCopySection( b, other, 0, 0, w, h, 0, 0 );
+	}
+	report( "boardCopySection", b, nowNs() - t0, reps, 0 );
+
+	size_t sel_bytes = 0;
+	t0 = nowNs();
+	for( r = 0; r < reps; r++ ) {
+		Board * sel = boardMakeFromSelection( b, 0, 0, w, h );
+		sel_bytes = boardMemoryUsage( sel );
+		boardFree( sel );
+	}
+	report( "MakeFromSelection", b, nowNs() - t0, reps, sel_bytes );
+
+	t0 = nowNs();
+	boardSaveToFile( b, (char *)scratch_file );
+	report( "save binary", b, nowNs() - t0, 1, fileSize( scratch_file ) );
+
+	t0 = nowNs();
+	Board * loaded = boardLoadFromFile( (char *)scratch_file );
+	report( "load binary", b, nowNs() - t0, 1, loaded ? boardMemoryUsage( loaded ) : 0 );
+	boardFree( loaded );
+
+	// Open a one-board pack and take a view: no parse, no cell copy.
+	char * pack_name = "bench";
+	packWrite( scratch_file, &pack_name, &b, 1 );
+	t0 = nowNs();
+	Pack * pack = packOpen( scratch_file );
+	loaded = pack ? packGetBoard( pack, pack_name ) : NULL;
+	packClose( pack );
+	report( "pack view", b, nowNs() - t0, 1, fileSize( scratch_file ) );
+	boardFree( loaded );
+
+	t0 = nowNs();
+	boardSaveToTextFile( b, (char *)scratch_file );
+	report( "save text", b, nowNs() - t0, 1, fileSize( scratch_file ) );
+
+	t0 = nowNs();
+	loaded = boardLoadFromFile( (char *)scratch_file );
+	report( "load text", b, nowNs() - t0, 1, loaded ? boardMemoryUsage( loaded ) : 0 );
+	boardFree( loaded );
+	remove( scratch_file );
+
+	// Render into a null terminal big enough for the whole board, so
+	// nothing is culled. No refresh(): this times boardDraw() itself.
+	resizeterm( h + 2, w + 2 );
+	Coord offset = { 1, 1 };
+	reps = reps > 64 ? 64 : reps;
+	t0 = nowNs();
+	for( r = 0; r < reps; r++ ) {
+		boardDraw( b, offset, true );
+	}
+	report( "boardDraw", b, nowNs() - t0, reps, 0 );
+
+	t0 = nowNs();
+	BakedBoard * baked = boardBake( b );
+	report( "boardBake", b, nowNs() - t0, 1, baked ? (size_t)w * h * sizeof(chtype) : 0 );
+	if( baked ) {
+		t0 = nowNs();
+		for( r = 0; r < reps; r++ ) {
+			bakedBlit( baked, stdscr, 1, 1 );
+		}
+		report( "bakedBlit", b, nowNs() - t0, reps, 0 );
+		bakedFree( baked );
+	}
+
+	boardFree( other );
+	boardFree( b );
+}
+
+int main( int argc, char * argv[] ) {
+	int only_w = 0, only_h = 0;
+	int opt;
+	while( ( opt = getopt( argc, argv, "s:o:" ) ) != -1 ) {
+		switch( opt ) {
+			case 's':
+				if( sscanf( optarg, "%dx%d", &only_w, &only_h ) != 2 || only_w < 1 || only_h < 1 ) {
+					fprintf( stderr, "bench: -s expects WxH\n" );
+					return 2;
+				}
+				break;
+			case 'o':
+				scratch_file = optarg;
+				break;
+			default:
+				fprintf( stderr, "usage: bench [-s WxH] [-o scratch_file]\n" );
+				return 2;
+		}
+	}
+
+	// Curses output goes nowhere; the terminal only exists for boardDraw().
+	FILE * null_out = fopen( "/dev/null", "w" );
+	const char * term = getenv( "TERM" );
+	SCREEN * screen = null_out ? newterm( term ? term : "xterm", null_out, stdin ) : NULL;
+	if( !screen ) {
+		fprintf( stderr, "bench: could not start a null curses terminal\n" );
+		return 1;
+	}
+	set_term( screen );
+	start_color();
+	curses_init_color_pairs();
+
+	if( only_w ) {
+		benchSize( only_w, only_h );
+	}
+	else {
+		size_t i;
+		for( i = 0; i < N_BENCH_SIZES; i++ ) {
+			benchSize( bench_sizes[i].x, bench_sizes[i].y );
+		}
+	}
+
+	endwin();
+	delscreen( screen );
+	fclose( null_out );
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*  brdpack: builds and lists asset packs (.brp), see pack.h.
+
+    Usage: brdpack -o out.brp file.brd...
+           brdpack -t pack.brp
+
+    Boards may be binary or text .brd files. Each is stored under its file
+    name without directories or a ".brd" extension, e.g. gfx/title.brd ->
+    "title"; names must be unique.                                        */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "pack.h"
+
+static void usage( void ) {
+	fprintf( stderr, "usage: brdpack -o out.brp file.brd...\n       brdpack -t pack.brp\n" );
+	exit( 2 );
+}
+
+// Entry name for a file: the base name without a ".brd" extension.
+static char * entryName( const char * filename ) {
+	const char * slash = strrchr( filename, '/' );
+	const char * base = slash ? slash + 1 : filename;
+	size_t len = strlen( base );
+	if( len > 4 && strcmp( base + len - 4, ".brd" ) == 0 ) {
+		len -= 4;
+	}
+	char * name = malloc( len + 1 );
+	if( name ) {
+		memcpy( name, base, len );
+		name[len] = '\0';
+	}
+	return name;
+}
+
+static int listPack( const char * filename ) {
+	Pack * pack = packOpen( filename );
+	if( !pack ) {
+		fprintf( stderr, "brdpack: could not open %s\n", filename );
+		return 1;
+	}
+	int i;
+	for( i = 0; i < packCount( pack ); i++ ) {
+		Board * b = packBoardAt( pack, i );
+		if( b ) {
+			printf( "%-32s %5dx%-5d%s\n", packName( pack, i ), b->w, b->h, b->color_enabled ? " color" : "" );
+			boardFree( b );
+		}
+	}
+	packClose( pack );
+	return 0;
+}
+
+static int buildPack( const char * out_name, char ** files, int n_files ) {
+	char ** names = calloc( n_files, sizeof(char *) );
+	Board ** boards = calloc( n_files, sizeof(Board *) );
+	int i, failed = 0;
+	if( !names || !boards ) {
+		fprintf( stderr, "brdpack: out of memory\n" );
+		return 1;
+	}
+	for( i = 0; i < n_files; i++ ) {
+		names[i] = entryName( files[i] );
+		boards[i] = boardLoadFromFile( files[i] );
+		if( !names[i] || !boards[i] ) {
+			fprintf( stderr, "brdpack: could not load %s\n", files[i] );
+			failed++;
+		}
+	}
+	if( !failed && !packWrite( out_name, names, boards, n_files ) ) {
+		fprintf( stderr, "brdpack: could not write %s\n", out_name );
+		failed++;
+	}
+	for( i = 0; i < n_files; i++ ) {
+		free( names[i] );
+		boardFree( boards[i] );
+	}
+	free( names );
+	free( boards );
+	return failed ? 1 : 0;
+}
+
+int main( int argc, char * argv[] ) {
+	const char * out_name = NULL;
+	const char * list_name = NULL;
+
+	int opt;
+	while( ( opt = getopt( argc, argv, "o:t:" ) ) != -1 ) {
+		switch( opt ) {
+			case 'o':
+				out_name = optarg;
+				break;
+			case 't':
+				list_name = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+	if( !out_name == !list_name || ( out_name && optind >= argc ) ) {
+		usage();
+	}
+
+	// Board code reports problems through errLog(); send them to stderr.
+	error_handler.f_err_log = stderr;
+	error_handler.redirect_to_stderr = 1;
+	error_handler.initialized = 1;
+
+	int ret = list_name ? listPack( list_name ) : buildPack( out_name, argv + optind, argc - optind );
+	errorHandlerShutdown( &error_handler );
+	return ret;
+}
@@ -0,0 +1,177 @@
+/*  brdtool: headless .brd converter. Converts any number of boards to plain
+    text, ANSI or HTML on a pool of worker threads, without curses.
+
+    Usage: brdtool [-f text|ansi|html] [-j jobs] [-d outdir] file.brd...
+
+    Layered .brl boards are exported as shown: visible layers flattened.
+
+    Each input is written next to itself (or into outdir) with the format's
+    extension appended, e.g. snek.brd -> snek.brd.ans                        */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "board_export.h"
+#include "layer.h"
+
+#define MAX_JOBS 64
+
+typedef struct Batch_t {
+	char ** files;
+	int n_files;
+	int format;
+	const char * out_dir;
+
+	pthread_mutex_t lock;
+	int next;       // Index of the next file to hand out.
+	int failed;
+} Batch;
+
+static bool convertOne( Batch * batch, char * in_name ) {
+	char out_name[4096];
+	const char * base = in_name;
+	if( batch->out_dir ) {
+		const char * slash = strrchr( in_name, '/' );
+		base = slash ? slash + 1 : in_name;
+		snprintf( out_name, sizeof(out_name), "%s/%s%s", batch->out_dir, base, exportFormatExtension( batch->format ) );
+	}
+	else {
+		snprintf( out_name, sizeof(out_name), "%s%s", in_name, exportFormatExtension( batch->format ) );
+	}
+
+	Board * brd = NULL;
+	LayerStack * stack = NULL;
+	if( layerFileCheck( in_name ) ) {
+		stack = layerStackLoad( in_name );
+		brd = stack ? layerStackComposite( stack ) : NULL;
+	}
+	else {
+		brd = boardLoadFromFile( in_name );
+	}
+	if( !brd ) {
+		fprintf( stderr, "brdtool: could not load %s\n", in_name );
+		return false;
+	}
+	FILE * f = fopen( out_name, "w" );
+	if( !f ) {
+		fprintf( stderr, "brdtool: could not open %s for writing\n", out_name );
+		if( stack ) {
+			layerStackFree( stack );
+		}
+		else {
+			boardFree( brd );
+		}
+		return false;
+	}
+	bool ok = boardExport( brd, f, batch->format );
+	if( fclose( f ) != 0 || !ok ) {
+		fprintf( stderr, "brdtool: write error on %s\n", out_name );
+		ok = false;
+	}
+	if( stack ) {
+		layerStackFree( stack );
+	}
+	else {
+		boardFree( brd );
+	}
+	return ok;
+}
+
+// Worker: keep taking the next unconverted file until none are left.
+static void * worker( void * arg ) {
+	Batch * batch = arg;
+	for( ;; ) {
+		pthread_mutex_lock( &batch->lock );
+		int i = batch->next++;
+		pthread_mutex_unlock( &batch->lock );
+		if( i >= batch->n_files ) {
+			break;
+		}
+		if( !convertOne( batch, batch->files[i] ) ) {
+			pthread_mutex_lock( &batch->lock );
+			batch->failed++;
+			pthread_mutex_unlock( &batch->lock );
+		}
+	}
+	return NULL;
+}
+
+static void usage( void ) {
+	fprintf( stderr, "usage: brdtool [-f text|ansi|html] [-j jobs] [-d outdir] file.brd...\n" );
+	exit( 2 );
+}
+
+int main( int argc, char * argv[] ) {
+	Batch batch;
+	memset( &batch, 0, sizeof(batch) );
+	batch.format = EXPORT_TEXT;
+
+	long n_cpu = sysconf( _SC_NPROCESSORS_ONLN );
+	int n_jobs = n_cpu > 0 ? (int)n_cpu : 1;
+
+	int opt;
+	while( ( opt = getopt( argc, argv, "f:j:d:" ) ) != -1 ) {
+		switch( opt ) {
+			case 'f':
+				batch.format = exportFormatFromName( optarg );
+				if( batch.format < 0 ) {
+					usage();
+				}
+				break;
+			case 'j':
+				n_jobs = atoi( optarg );
+				break;
+			case 'd':
+				batch.out_dir = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+	if( optind >= argc ) {
+		usage();
+	}
+	batch.files = argv + optind;
+	batch.n_files = argc - optind;
+
+	if( n_jobs < 1 ) {
+		n_jobs = 1;
+	}
+	if( n_jobs > MAX_JOBS ) {
+		n_jobs = MAX_JOBS;
+	}
+	if( n_jobs > batch.n_files ) {
+		n_jobs = batch.n_files;
+	}
+
+	// Board code reports problems through errLog(); send them to stderr
+	// quietly instead of appending to debug.log.
+	error_handler.f_err_log = stderr;
+	error_handler.redirect_to_stderr = 1;
+	error_handler.initialized = 1;
+
+	pthread_mutex_init( &batch.lock, NULL );
+	pthread_t threads[MAX_JOBS];
+	int i;
+	for( i = 0; i < n_jobs; i++ ) {
+		if( pthread_create( &threads[i], NULL, worker, &batch ) != 0 ) {
+			fprintf( stderr, "brdtool: pthread_create() failed; continuing with %d worker(s)\n", i );
+			break;
+		}
+	}
+	if( i == 0 ) {
+		worker( &batch );
+	}
+	int n_started = i;
+	for( i = 0; i < n_started; i++ ) {
+		pthread_join( threads[i], NULL );
+	}
+	pthread_mutex_destroy( &batch.lock );
+
+	errorHandlerShutdown( &error_handler );
+	return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Keys listed individually in the replay report, slowest first.
+#define TRACE_REPORT_KEYS 10
+
+static uint64_t traceNow( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static bool traceOpen( Trace * t, char * filename, const char * mode ) {
+	memset( t, 0, sizeof(Trace) );
+	t->f = fopen( filename, mode );
+	if( !t->f ) {
+		errLog( "traceOpen(): Could not open %s", filename );
+		return false;
+	}
+	t->filename = filename;
+	return true;
+}
+
+// Start recording to filename. The header takes the terminal's current
+// size and type, so curses must be started.
+bool traceRecordOpen( Trace * t, char * filename, int board_w, int board_h, long now_ms ) {
+	if( !traceOpen( t, filename, "w" ) ) {
+		return false;
+	}
+	const char * term = getenv( "TERM" );
+	t->start_ms = now_ms;
+	fprintf( t->f, "%s %d %d %d %d %d %s\n", TRACE_MAGIC, TRACE_VERSION, board_w, board_h, LINES, COLS, term && *term ? term : "dumb" );
+	return true;
+}
+
+void traceRecordKey( Trace * t, int key, long now_ms ) {
+	if( key == KEY_RESIZE ) {
+		fprintf( t->f, "%ld %d %d %d\n", now_ms - t->start_ms, key, LINES, COLS );
+	}
+	else {
+		fprintf( t->f, "%ld %d\n", now_ms - t->start_ms, key );
+	}
+}
+
+// Open filename for replay and read its header into t.
+bool traceReplayOpen( Trace * t, char * filename ) {
+	if( !traceOpen( t, filename, "r" ) ) {
+		return false;
+	}
+	t->replay = true;
+	char magic[8];
+	int version;
+	if( fscanf( t->f, "%7s %d %d %d %d %d %63s", magic, &version, &t->board_w, &t->board_h, &t->lines, &t->cols, t->term ) != 7
+		|| strcmp( magic, TRACE_MAGIC ) != 0 || version != TRACE_VERSION ) {
+		errLog( "traceReplayOpen(): %s is not a version %d input trace", filename, TRACE_VERSION );
+		traceClose( t );
+		return false;
+	}
+	t->replay_start_ns = traceNow();
+	return true;
+}
+
+/*  The next recorded key, or ERR at the end of the trace (or at the first
+    malformed line, which is logged). A resize is applied to curses before
+    KEY_RESIZE is returned, as the terminal would have.                  */
+int traceReplayKey( Trace * t ) {
+	long ms;
+	int key;
+	int n = fscanf( t->f, "%ld %d", &ms, &key );
+	if( n != 2 ) {
+		if( n != EOF ) {
+			errLog( "traceReplayKey(): %s: bad line after %zu keys", t->filename, t->n_samples );
+		}
+		return ERR;
+	}
+	if( key == KEY_RESIZE ) {
+		int lines, cols;
+		if( fscanf( t->f, "%d %d", &lines, &cols ) != 2 ) {
+			errLog( "traceReplayKey(): %s: resize without a size after %zu keys", t->filename, t->n_samples );
+			return ERR;
+		}
+		resizeterm( lines, cols );
+	}
+	if( t->n_samples == t->cap ) {
+		size_t cap = t->cap ? t->cap * 2 : 1024;
+		TraceSample * samples = realloc( t->samples, cap * sizeof(TraceSample) );
+		if( !samples ) {
+			errLog( "traceReplayKey(): realloc() failed on %zu samples", cap );
+			return ERR;
+		}
+		t->samples = samples;
+		t->cap = cap;
+	}
+	t->samples[t->n_samples] = (TraceSample){ key, 0, 0 };
+	t->key_open = true;
+	t->key_ns = traceNow();
+	t->handled_ns = t->key_ns;
+	return key;
+}
+
+// The current key has been handled; drawing starts.
+void traceKeyHandled( Trace * t ) {
+	if( t->key_open ) {
+		t->handled_ns = traceNow();
+		t->samples[t->n_samples].process_ns = t->handled_ns - t->key_ns;
+	}
+}
+
+// The frame showing the current key has been refreshed.
+void traceKeyShown( Trace * t ) {
+	if( t->key_open ) {
+		t->samples[t->n_samples].render_ns = traceNow() - t->handled_ns;
+		t->n_samples++;
+		t->key_open = false;
+	}
+}
+
+static int cmpU32( const void * a, const void * b ) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return ( x > y ) - ( x < y );
+}
+
+// count, p50, p99 and max of n durations in us, on one line.
+static void reportLine( FILE * out, const char * name, uint32_t * ns, size_t n ) {
+	qsort( ns, n, sizeof(uint32_t), cmpU32 );
+	fprintf( out, "%-12s %8zu %9.1f %9.1f %9.1f\n", name, n,
+		n ? ns[ n / 2 ] / 1000.0 : 0.0, n ? ns[ n * 99 / 100 ] / 1000.0 : 0.0, n ? ns[ n - 1 ] / 1000.0 : 0.0 );
+}
+
+typedef struct KeyTotal_t {
+	int key;
+	uint64_t ns;
+} KeyTotal;
+
+static int cmpKeyTotal( const void * a, const void * b ) {
+	uint64_t x = ( (const KeyTotal *)a )->ns, y = ( (const KeyTotal *)b )->ns;
+	return ( x < y ) - ( x > y );
+}
+
+/*  Per-key processing and render latency over the whole replay, then
+    processing latency for the keys that took the most time in total,
+    then the final board's checksum.                                     */
+void traceReport( Trace * t, FILE * out, uint64_t checksum ) {
+	size_t n = t->n_samples, i, j;
+	uint32_t * ns = malloc( ( n ? n : 1 ) * sizeof(uint32_t) );
+	KeyTotal * totals = malloc( ( n ? n : 1 ) * sizeof(KeyTotal) );
+	if( !ns || !totals ) {
+		errLog( "traceReport(): malloc() failed on %zu samples", n );
+		free( ns );
+		free( totals );
+		return;
+	}
+	fprintf( out, "replay %s: %zu keys in %.2f s\n", t->filename, n, ( traceNow() - t->replay_start_ns ) / 1e9 );
+	fprintf( out, "%-12s %8s %9s %9s %9s\n", "", "count", "p50_us", "p99_us", "max_us" );
+	for( i = 0; i < n; i++ ) {
+		ns[i] = t->samples[i].process_ns;
+	}
+	reportLine( out, "process", ns, n );
+	for( i = 0; i < n; i++ ) {
+		ns[i] = t->samples[i].render_ns;
+	}
+	reportLine( out, "render", ns, n );
+
+	size_t n_keys = 0;
+	for( i = 0; i < n; i++ ) {
+		for( j = 0; j < n_keys && totals[j].key != t->samples[i].key; j++ );
+		if( j == n_keys ) {
+			totals[n_keys++] = (KeyTotal){ t->samples[i].key, 0 };
+		}
+		totals[j].ns += t->samples[i].process_ns;
+	}
+	qsort( totals, n_keys, sizeof(KeyTotal), cmpKeyTotal );
+	for( j = 0; j < n_keys && j < TRACE_REPORT_KEYS; j++ ) {
+		size_t m = 0;
+		for( i = 0; i < n; i++ ) {
+			if( t->samples[i].key == totals[j].key ) {
+				ns[m++] = t->samples[i].process_ns;
+			}
+		}
+		char name[32];
+		int key = totals[j].key;
+		const char * kn = keyname( key );
+		if( key >= ' ' && key < 127 ) {
+			snprintf( name, sizeof(name), "  '%c'", key );
+		}
+		else {
+			snprintf( name, sizeof(name), "  %s", kn ? kn : "?" );
+		}
+		reportLine( out, name, ns, m );
+	}
+	fprintf( out, "checksum %016llx\n", (unsigned long long)checksum );
+	free( ns );
+	free( totals );
+}
+
+void traceClose( Trace * t ) {
+	if( t->f ) {
+		fclose( t->f );
+	}
+	free( t->samples );
+	t->f = NULL;
+	t->samples = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "board.h"
+
+/*  Input traces: the keys of an editing session, recorded so the session
+    can be replayed without a terminal, for regression tests of both the
+    result (a checksum of the final board) and per-key latency.
+
+    Replay feeds the keys through the editor's main loop as they were
+    recorded, but without waiting: every key is handled and then drawn on
+    its own, to a null terminal of the recorded size and type, so each
+    key gets one processing and one render time.
+
+    .trc files are text, so traces can be written or trimmed by hand:
+      BRDT 1 <board w> <board h> <LINES> <COLS> <TERM>
+      <ms since start> <key code>
+      <ms since start> <KEY_RESIZE> <LINES> <COLS>
+      ...
+    Key codes are getch() values: characters as themselves, curses keys
+    (arrows, Delete, ...) as their KEY_* numbers.                        */
+#define TRACE_MAGIC "BRDT"
+#define TRACE_VERSION 1
+#define TRACE_TERM_LEN 64
+
+typedef struct TraceSample_t {
+	int key;
+	uint32_t process_ns;    // Handling the key.
+	uint32_t render_ns;     // Drawing and refreshing the frame that shows it.
+} TraceSample;
+
+typedef struct Trace_t {
+	FILE * f;
+	bool replay;
+	char * filename;
+	long start_ms;          // Recording: when the session started.
+
+	// From the header.
+	int board_w;
+	int board_h;
+	int lines;
+	int cols;
+	char term[TRACE_TERM_LEN];
+
+	// Replay: per-key timings, and when the current key was read / handled.
+	TraceSample * samples;
+	size_t n_samples;
+	size_t cap;
+	bool key_open;          // A key has been read but not yet shown.
+	uint64_t key_ns;
+	uint64_t handled_ns;
+	uint64_t replay_start_ns;
+} Trace;
+
+bool traceRecordOpen( Trace * t, char * filename, int board_w, int board_h, long now_ms );
+void traceRecordKey( Trace * t, int key, long now_ms );
+bool traceReplayOpen( Trace * t, char * filename );
+int traceReplayKey( Trace * t );
+void traceKeyHandled( Trace * t );
+void traceKeyShown( Trace * t );
+void traceReport( Trace * t, FILE * out, uint64_t checksum );
+void traceClose( Trace * t );
+
+#endif // TRACE_H
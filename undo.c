@@ -0,0 +1,429 @@
+#include "undo.h"
+
+#define UNDO_REC_CELL 1
+#define UNDO_REC_SPAN 2
+#define UNDO_REC_SWAP 3
+
+// Size of the u32 length written before and after every step.
+#define UNDO_FRAME_SIZE 4
+
+// kind, x, y, old, new
+#define UNDO_CELL_SIZE ( 1 + 4*4 )
+// kind, x, y, len (followed by the two run lists)
+#define UNDO_SPAN_HEAD_SIZE ( 1 + 3*4 )
+// kind, old board, new board
+#define UNDO_SWAP_SIZE ( 1 + 2*sizeof(Board *) )
+
+static void ringWrite( UndoJournal * j, uint64_t off, const void * src, size_t n ) {
+	size_t pos = off % j->cap;
+	size_t first = j->cap - pos < n ? j->cap - pos : n;
+	memcpy( j->buf + pos, src, first );
+	memcpy( j->buf, (const unsigned char *)src + first, n - first );
+}
+
+static void ringRead( UndoJournal * j, uint64_t off, void * dst, size_t n ) {
+	size_t pos = off % j->cap;
+	size_t first = j->cap - pos < n ? j->cap - pos : n;
+	memcpy( dst, j->buf + pos, first );
+	memcpy( (unsigned char *)dst + first, j->buf, n - first );
+}
+
+static uint32_t ringReadU32( UndoJournal * j, uint64_t off ) {
+	uint32_t v;
+	ringRead( j, off, &v, 4 );
+	return v;
+}
+
+static uint64_t recordSize( UndoJournal * j, uint64_t off ) {
+	unsigned char kind;
+	ringRead( j, off, &kind, 1 );
+	if( kind == UNDO_REC_CELL ) {
+		return UNDO_CELL_SIZE;
+	}
+	if( kind == UNDO_REC_SPAN ) {
+		uint32_t n_old = ringReadU32( j, off + UNDO_SPAN_HEAD_SIZE );
+		uint32_t n_new = ringReadU32( j, off + UNDO_SPAN_HEAD_SIZE + 4 + (uint64_t)n_old * 8 );
+		return UNDO_SPAN_HEAD_SIZE + 4 + (uint64_t)n_old * 8 + 4 + (uint64_t)n_new * 8;
+	}
+	return UNDO_SWAP_SIZE;
+}
+
+/*  Records in [from, to) are being forgotten. For swaps, free whichever
+    board is not live: the old one if the step is applied, otherwise the
+    new one.                                                              */
+static void releaseRecords( UndoJournal * j, uint64_t from, uint64_t to, bool applied ) {
+	while( from < to ) {
+		unsigned char kind;
+		ringRead( j, from, &kind, 1 );
+		if( kind == UNDO_REC_SWAP ) {
+			Board * boards[2];
+			ringRead( j, from + 1, boards, sizeof(boards) );
+			Board * dead = applied ? boards[0] : boards[1];
+			j->extra -= boardMemoryUsage( dead );
+			boardFree( dead );
+		}
+		from += recordSize( j, from );
+	}
+}
+
+static void evictOldest( UndoJournal * j ) {
+	uint32_t len = ringReadU32( j, j->tail );
+	releaseRecords( j, j->tail + UNDO_FRAME_SIZE, j->tail + UNDO_FRAME_SIZE + len, true );
+	j->tail += 2*UNDO_FRAME_SIZE + len;
+	if( j->cursor < j->tail ) {
+		j->cursor = j->tail;
+	}
+}
+
+static void truncateRedo( UndoJournal * j ) {
+	uint64_t off = j->cursor;
+	while( off < j->head ) {
+		uint32_t len = ringReadU32( j, off );
+		releaseRecords( j, off + UNDO_FRAME_SIZE, off + UNDO_FRAME_SIZE + len, false );
+		off += 2*UNDO_FRAME_SIZE + len;
+	}
+	j->head = j->cursor;
+}
+
+// Make room for n more bytes (plus the closing frame) by dropping the oldest
+// closed steps. Fails if the open step alone would exceed the budget.
+static bool reserve( UndoJournal * j, size_t n ) {
+	uint64_t limit = j->step_start_valid ? j->step_start : j->head;
+	while( ( j->head - j->tail ) + n + UNDO_FRAME_SIZE + j->extra > j->cap ) {
+		if( j->tail >= limit ) {
+			return false;
+		}
+		evictOldest( j );
+	}
+	return true;
+}
+
+// Open the step on disk (so to speak) before its first record.
+static bool beginRecord( UndoJournal * j, size_t n ) {
+	if( !j->step_open ) {
+		undoBeginStep( j );
+	}
+	if( j->step_overflow ) {
+		return false;
+	}
+	if( !j->step_start_valid ) {
+		truncateRedo( j );
+		if( !reserve( j, UNDO_FRAME_SIZE ) ) {
+			j->step_overflow = true;
+			return false;
+		}
+		j->step_start = j->head;
+		j->step_start_valid = true;
+		j->head += UNDO_FRAME_SIZE;
+	}
+	if( !reserve( j, n ) ) {
+		j->step_overflow = true;
+		return false;
+	}
+	return true;
+}
+
+UndoJournal * undoInit( size_t budget ) {
+	UndoJournal * j = calloc( 1, sizeof(UndoJournal) );
+	if( !j ) {
+		errLog( "undoInit(): calloc() failed on journal" );
+		return NULL;
+	}
+	j->cap = budget;
+	j->buf = malloc( budget );
+	if( !j->buf ) {
+		errLog( "undoInit(): malloc() failed on %zu byte buffer", budget );
+		free( j );
+		return NULL;
+	}
+	return j;
+}
+
+void undoFree( UndoJournal * j ) {
+	if( j ) {
+		undoClear( j );
+		if( j->board ) {
+			j->board->journal = NULL;
+		}
+		free( j->buf );
+		free( j->runs );
+		free( j->offsets );
+		free( j );
+	}
+}
+
+// Forget all history. The live board is untouched.
+void undoClear( UndoJournal * j ) {
+	if( j->step_start_valid ) {
+		uint64_t off = j->tail;
+		while( off < j->step_start ) {
+			uint32_t len = ringReadU32( j, off );
+			releaseRecords( j, off + UNDO_FRAME_SIZE, off + UNDO_FRAME_SIZE + len, true );
+			off += 2*UNDO_FRAME_SIZE + len;
+		}
+		releaseRecords( j, j->step_start + UNDO_FRAME_SIZE, j->head, true );
+	}
+	else {
+		uint64_t off = j->tail;
+		while( off < j->head ) {
+			uint32_t len = ringReadU32( j, off );
+			releaseRecords( j, off + UNDO_FRAME_SIZE, off + UNDO_FRAME_SIZE + len, off < j->cursor );
+			off += 2*UNDO_FRAME_SIZE + len;
+		}
+	}
+	j->tail = j->cursor = j->head = 0;
+	j->step_start_valid = false;
+}
+
+void undoAttach( UndoJournal * j, Board * board ) {
+	if( j->board ) {
+		j->board->journal = NULL;
+	}
+	j->board = board;
+	if( board ) {
+		board->journal = j;
+	}
+}
+
+void undoBeginStep( UndoJournal * j ) {
+	if( j && !j->step_open ) {
+		j->step_open = true;
+		j->step_overflow = false;
+	}
+}
+
+// Close the open step, unless coalescing. Steps with no records vanish.
+void undoEndStep( UndoJournal * j ) {
+	if( !j || !j->step_open || j->coalesce ) {
+		return;
+	}
+	j->step_open = false;
+	if( j->step_overflow ) {
+		errLog( "undoEndStep(): step exceeded the %zu byte undo budget; history cleared.", j->cap );
+		undoClear( j );
+		j->step_overflow = false;
+		return;
+	}
+	if( j->step_start_valid ) {
+		uint32_t len = j->head - j->step_start - UNDO_FRAME_SIZE;
+		ringWrite( j, j->step_start, &len, 4 );
+		ringWrite( j, j->head, &len, 4 );
+		j->head += UNDO_FRAME_SIZE;
+		j->cursor = j->head;
+		j->step_start_valid = false;
+	}
+}
+
+// While coalescing, every edit joins the open step (doodle strokes, typing).
+void undoCoalesce( UndoJournal * j, bool coalesce ) {
+	if( j ) {
+		j->coalesce = coalesce;
+	}
+}
+
+void undoRecordCell( UndoJournal * j, int x, int y, Cell old_cell, Cell new_cell ) {
+	if( old_cell == new_cell || !beginRecord( j, UNDO_CELL_SIZE ) ) {
+		return;
+	}
+	unsigned char rec[UNDO_CELL_SIZE];
+	int32_t xy[2] = { x, y };
+	rec[0] = UNDO_REC_CELL;
+	memcpy( rec + 1, xy, 8 );
+	memcpy( rec + 9, &old_cell, 4 );
+	memcpy( rec + 13, &new_cell, 4 );
+	ringWrite( j, j->head, rec, UNDO_CELL_SIZE );
+	j->head += UNDO_CELL_SIZE;
+}
+
+// Append (count, value) run-length pairs for n cells to runs; returns pair count.
+static uint32_t encodeRuns( uint32_t * runs, const Cell * cells, Cell fill, Board * board, int x, int y, int n ) {
+	uint32_t n_runs = 0;
+	int i;
+	for( i = 0; i < n; i++ ) {
+		Cell c = board ? boardGetCell( board, x + i, y ) : ( cells ? cells[i] : fill );
+		if( n_runs > 0 && runs[ ( n_runs - 1 ) * 2 + 1 ] == c ) {
+			runs[ ( n_runs - 1 ) * 2 ]++;
+		}
+		else {
+			runs[ n_runs * 2 ] = 1;
+			runs[ n_runs * 2 + 1 ] = c;
+			n_runs++;
+		}
+	}
+	return n_runs;
+}
+
+/*  Record a horizontal run of len cells at x, y before it is overwritten.
+    The new values come from new_cells, or are all new_fill if new_cells is
+    NULL. Must be called before the board is written.                       */
+void undoRecordSpan( UndoJournal * j, Board * board, int x, int y, int len, const Cell * new_cells, Cell new_fill ) {
+	if( len < 1 ) {
+		return;
+	}
+	if( j->runs_cap < (size_t)len * 4 ) {
+		uint32_t * runs = realloc( j->runs, (size_t)len * 4 * sizeof(uint32_t) );
+		if( !runs ) {
+			errLog( "undoRecordSpan(): realloc() failed on %d cell run buffer", len );
+			beginRecord( j, 0 );
+			j->step_overflow = true;
+			return;
+		}
+		j->runs = runs;
+		j->runs_cap = (size_t)len * 4;
+	}
+	uint32_t * old_runs = j->runs;
+	uint32_t n_old = encodeRuns( old_runs, NULL, 0, board, x, y, len );
+	uint32_t * new_runs = old_runs + n_old * 2;
+	uint32_t n_new = encodeRuns( new_runs, new_cells, new_fill, NULL, 0, 0, len );
+	if( n_old == 1 && n_new == 1 && old_runs[1] == new_runs[1] ) {
+		return;
+	}
+
+	size_t size = UNDO_SPAN_HEAD_SIZE + 4 + n_old * 8 + 4 + n_new * 8;
+	if( !beginRecord( j, size ) ) {
+		return;
+	}
+	unsigned char head[UNDO_SPAN_HEAD_SIZE];
+	int32_t xyl[3] = { x, y, len };
+	head[0] = UNDO_REC_SPAN;
+	memcpy( head + 1, xyl, 12 );
+	uint64_t off = j->head;
+	ringWrite( j, off, head, UNDO_SPAN_HEAD_SIZE );
+	off += UNDO_SPAN_HEAD_SIZE;
+	ringWrite( j, off, &n_old, 4 );
+	ringWrite( j, off + 4, old_runs, n_old * 8 );
+	off += 4 + n_old * 8;
+	ringWrite( j, off, &n_new, 4 );
+	ringWrite( j, off + 4, new_runs, n_new * 8 );
+	j->head += size;
+}
+
+/*  Record that the live board is being replaced by new_board, and attach
+    the journal to it. On success the journal owns old_board; on failure
+    (it doesn't fit the budget) the caller must free it.                   */
+bool undoRecordSwap( UndoJournal * j, Board * old_board, Board * new_board ) {
+	size_t held = boardMemoryUsage( old_board );
+	undoAttach( j, new_board );
+	if( !beginRecord( j, UNDO_SWAP_SIZE + held ) ) {
+		return false;
+	}
+	unsigned char rec[UNDO_SWAP_SIZE];
+	Board * boards[2] = { old_board, new_board };
+	rec[0] = UNDO_REC_SWAP;
+	memcpy( rec + 1, boards, sizeof(boards) );
+	ringWrite( j, j->head, rec, UNDO_SWAP_SIZE );
+	j->head += UNDO_SWAP_SIZE;
+	j->extra += held;
+	return true;
+}
+
+bool undoCanUndo( UndoJournal * j ) {
+	return j->step_start_valid || j->cursor > j->tail;
+}
+
+bool undoCanRedo( UndoJournal * j ) {
+	return !j->step_start_valid && j->cursor < j->head;
+}
+
+// Write a run list back onto the board, starting at x, y.
+static void applyRuns( UndoJournal * j, uint64_t off, uint32_t n_runs, int x, int y ) {
+	uint32_t i, k;
+	for( i = 0; i < n_runs; i++ ) {
+		uint32_t run[2];
+		ringRead( j, off + (uint64_t)i * 8, run, 8 );
+		for( k = 0; k < run[0]; k++ ) {
+			boardPutCell( j->board, run[1], x++, y );
+		}
+	}
+}
+
+static void applyRecord( UndoJournal * j, uint64_t off, bool undo ) {
+	unsigned char kind;
+	ringRead( j, off, &kind, 1 );
+	if( kind == UNDO_REC_CELL ) {
+		int32_t xy[2];
+		Cell cells[2];
+		ringRead( j, off + 1, xy, 8 );
+		ringRead( j, off + 9, cells, 8 );
+		boardPutCell( j->board, undo ? cells[0] : cells[1], xy[0], xy[1] );
+	}
+	else if( kind == UNDO_REC_SPAN ) {
+		int32_t xyl[3];
+		ringRead( j, off + 1, xyl, 12 );
+		uint64_t p = off + UNDO_SPAN_HEAD_SIZE;
+		uint32_t n_old = ringReadU32( j, p );
+		if( undo ) {
+			applyRuns( j, p + 4, n_old, xyl[0], xyl[1] );
+		}
+		else {
+			p += 4 + (uint64_t)n_old * 8;
+			applyRuns( j, p + 4, ringReadU32( j, p ), xyl[0], xyl[1] );
+		}
+	}
+	else {
+		Board * boards[2];
+		ringRead( j, off + 1, boards, sizeof(boards) );
+		j->board = undo ? boards[0] : boards[1];
+		// The budget counts whichever board is now inactive.
+		j->extra += boardMemoryUsage( undo ? boards[1] : boards[0] );
+		j->extra -= boardMemoryUsage( j->board );
+		boardMarkAllDirty( j->board );
+	}
+}
+
+// Apply the step whose records span [from, to), backwards when undoing.
+static void applyStep( UndoJournal * j, uint64_t from, uint64_t to, bool undo ) {
+	size_t n = 0;
+	uint64_t off;
+	for( off = from; off < to; off += recordSize( j, off ) ) {
+		if( n == j->offsets_cap ) {
+			size_t cap = j->offsets_cap ? j->offsets_cap * 2 : 64;
+			uint64_t * offsets = realloc( j->offsets, cap * sizeof(uint64_t) );
+			if( !offsets ) {
+				errLog( "applyStep(): realloc() failed on %zu record offsets", cap );
+				return;
+			}
+			j->offsets = offsets;
+			j->offsets_cap = cap;
+		}
+		j->offsets[n++] = off;
+	}
+
+	// Replaying must not record anything, so detach while writing.
+	j->board->journal = NULL;
+	size_t i;
+	for( i = 0; i < n; i++ ) {
+		applyRecord( j, j->offsets[ undo ? n - 1 - i : i ], undo );
+	}
+	j->board->journal = j;
+}
+
+static void closeOpenStep( UndoJournal * j ) {
+	bool coalesce = j->coalesce;
+	j->coalesce = false;
+	undoEndStep( j );
+	j->coalesce = coalesce;
+}
+
+// Undo the most recent step. Returns the live board, which differs from
+// the previous one if the step replaced the board.
+Board * undoUndo( UndoJournal * j ) {
+	closeOpenStep( j );
+	if( j->cursor > j->tail ) {
+		uint32_t len = ringReadU32( j, j->cursor - UNDO_FRAME_SIZE );
+		uint64_t start = j->cursor - 2*UNDO_FRAME_SIZE - len;
+		applyStep( j, start + UNDO_FRAME_SIZE, start + UNDO_FRAME_SIZE + len, true );
+		j->cursor = start;
+	}
+	return j->board;
+}
+
+Board * undoRedo( UndoJournal * j ) {
+	closeOpenStep( j );
+	if( j->cursor < j->head ) {
+		uint32_t len = ringReadU32( j, j->cursor );
+		applyStep( j, j->cursor + UNDO_FRAME_SIZE, j->cursor + UNDO_FRAME_SIZE + len, false );
+		j->cursor += 2*UNDO_FRAME_SIZE + len;
+	}
+	return j->board;
+}
@@ -0,0 +1,64 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdint.h>
+
+#include "board.h"
+
+#define UNDO_DEFAULT_BUDGET ( 4 * 1024 * 1024 )
+
+/*  Undo/redo history, stored as cell deltas in a ring buffer of a fixed
+    byte budget. Each step is framed as [u32 len][records][u32 len] so it
+    can be walked in either direction. Records are:
+      cell:  one cell's old and new value
+      span:  a horizontal run of cells, old and new values run-length encoded
+             (a fill or wipe of one row is usually a couple of runs)
+      swap:  the whole board was replaced (load); the inactive Board is kept
+             alive by the journal and counts against the budget
+    When a new step does not fit, the oldest steps are dropped.              */
+typedef struct UndoJournal_t {
+	unsigned char * buf;
+	size_t cap;
+
+	// Monotonic byte offsets into buf, taken modulo cap. Steps between tail
+	// and cursor are applied; steps between cursor and head can be redone.
+	uint64_t tail;
+	uint64_t cursor;
+	uint64_t head;
+
+	size_t extra;           // Bytes held outside the ring by swapped-out boards.
+
+	bool step_open;
+	bool step_overflow;     // The open step outgrew the budget.
+	bool coalesce;          // Keep the open step open across undoEndStep().
+	bool step_start_valid;  // The open step has records, starting at step_start.
+	uint64_t step_start;
+
+	Board * board;          // The live board edits are recorded against.
+
+	// Scratch space, reused between calls.
+	uint32_t * runs;
+	size_t runs_cap;
+	uint64_t * offsets;
+	size_t offsets_cap;
+} UndoJournal;
+
+UndoJournal * undoInit( size_t budget );
+void undoFree( UndoJournal * j );
+void undoClear( UndoJournal * j );
+void undoAttach( UndoJournal * j, Board * board );
+
+void undoBeginStep( UndoJournal * j );
+void undoEndStep( UndoJournal * j );
+void undoCoalesce( UndoJournal * j, bool coalesce );
+
+void undoRecordCell( UndoJournal * j, int x, int y, Cell old_cell, Cell new_cell );
+void undoRecordSpan( UndoJournal * j, Board * board, int x, int y, int len, const Cell * new_cells, Cell new_fill );
+bool undoRecordSwap( UndoJournal * j, Board * old_board, Board * new_board );
+
+bool undoCanUndo( UndoJournal * j );
+bool undoCanRedo( UndoJournal * j );
+Board * undoUndo( UndoJournal * j );
+Board * undoRedo( UndoJournal * j );
+
+#endif // UNDO_H